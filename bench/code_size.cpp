@@ -0,0 +1,142 @@
+// Part of Measurement Kit <https://measurement-kit.github.io/>.
+// Measurement Kit is free software under the BSD license. See AUTHORS
+// and LICENSE for more information on the copying conditions.
+
+// Generates translation units with many hook sites, compiles them in each
+// mode and reports, as one JSON object per line, the compile time, the
+// size of the object file and the size of its text. The modes are:
+//
+// - baseline: the same functions without including mkmock.hpp;
+// - disabled: MKMOCK_HOOK_DISABLED sites, which only include the header;
+// - enabled: MKMOCK_HOOK_ENABLED sites;
+// - static_keys: MKMOCK_HOOK_ENABLED sites with MKMOCK_USE_STATIC_KEYS;
+// - compiled_out: mkmock::hook sites with MKMOCK_HOOKS_COMPILED_IN zero.
+//
+// Usage:
+//
+//     code_size [compiler [include-dir [work-dir [sites...]]]]
+//
+// where sites defaults to 1000 and 10000. Build with:
+//
+//     c++ -std=c++11 -O2 -I. bench/code_size.cpp -o code_size
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#ifndef MKMOCK_CXX
+#define MKMOCK_CXX "c++"
+#endif
+
+#ifndef MKMOCK_SOURCE_DIR
+#define MKMOCK_SOURCE_DIR "."
+#endif
+
+static const char *const modes[] = {"baseline", "disabled", "enabled",
+                                    "static_keys", "compiled_out"};
+
+static bool generate(const std::string &path, const std::string &mode,
+                     unsigned sites) {
+  std::FILE *filep = std::fopen(path.c_str(), "w");
+  if (filep == nullptr) {
+    return false;
+  }
+  if (mode == "compiled_out") {
+    std::fprintf(filep, "#define MKMOCK_HOOKS_COMPILED_IN 0\n");
+  } else if (mode == "static_keys") {
+    std::fprintf(filep, "#define MKMOCK_USE_STATIC_KEYS\n");
+  }
+  if (mode != "baseline") {
+    std::fprintf(filep, "#include \"mkmock.hpp\"\n");
+  }
+  for (unsigned i = 0; i < sites; ++i) {
+    if (mode == "enabled" || mode == "static_keys" || mode == "compiled_out") {
+      std::fprintf(filep, "MKMOCK_DEFINE_HOOK(site_%u, int);\n", i);
+    }
+    std::fprintf(filep, "int function_%u(int value) {\n", i);
+    if (mode == "disabled") {
+      std::fprintf(filep, "  MKMOCK_HOOK_DISABLED(site_%u, value);\n", i);
+    } else if (mode == "enabled" || mode == "static_keys") {
+      std::fprintf(filep, "  MKMOCK_HOOK_ENABLED(site_%u, value);\n", i);
+    } else if (mode == "compiled_out") {
+      std::fprintf(filep, "  mkmock::hook<mkmock_site_%u>(value);\n", i);
+    }
+    std::fprintf(filep, "  return value + %u;\n}\n", i);
+  }
+  return std::fclose(filep) == 0;
+}
+
+static long long file_size(const std::string &path) {
+  std::FILE *filep = std::fopen(path.c_str(), "rb");
+  if (filep == nullptr) {
+    return -1;
+  }
+  std::fseek(filep, 0, SEEK_END);
+  long long size = std::ftell(filep);
+  std::fclose(filep);
+  return size;
+}
+
+// Uses the `size` tool, where available, to read the size of the text.
+static long long text_size(const std::string &object, const std::string &work) {
+  std::string output = work + "/size.txt";
+  std::string command = "size " + object + " > " + output + " 2>/dev/null";
+  if (std::system(command.c_str()) != 0) {
+    return -1;
+  }
+  std::FILE *filep = std::fopen(output.c_str(), "r");
+  if (filep == nullptr) {
+    return -1;
+  }
+  long long text = -1;
+  char header[256];
+  if (std::fgets(header, sizeof(header), filep) == nullptr ||
+      std::fscanf(filep, "%lld", &text) != 1) {
+    text = -1;
+  }
+  std::fclose(filep);
+  return text;
+}
+
+int main(int argc, char **argv) {
+  std::string compiler = (argc > 1) ? argv[1] : MKMOCK_CXX;
+  std::string include = (argc > 2) ? argv[2] : MKMOCK_SOURCE_DIR;
+  std::string work = (argc > 3) ? argv[3] : ".";
+  std::vector<unsigned> counts;
+  for (int i = 4; i < argc; ++i) {
+    counts.push_back(static_cast<unsigned>(std::strtoul(argv[i], nullptr, 10)));
+  }
+  if (counts.empty()) {
+    counts = {1000, 10000};
+  }
+  for (unsigned sites : counts) {
+    for (const char *mode : modes) {
+      std::string base =
+          work + "/code_size_" + mode + "_" + std::to_string(sites);
+      if (!generate(base + ".cpp", mode, sites)) {
+        std::perror(base.c_str());
+        return 1;
+      }
+      std::string command = compiler + " -std=c++11 -O2 -I" + include +
+                            " -c " + base + ".cpp -o " + base + ".o";
+      auto begin = std::chrono::steady_clock::now();
+      int status = std::system(command.c_str());
+      double seconds = std::chrono::duration<double>(
+                           std::chrono::steady_clock::now() - begin)
+                           .count();
+      if (status != 0) {
+        std::fprintf(stderr, "code_size: cannot compile %s.cpp\n",
+                     base.c_str());
+        return 1;
+      }
+      std::printf("{\"benchmark\":\"code_size\",\"mode\":\"%s\","
+                  "\"sites\":%u,\"compile_seconds\":%.3f,"
+                  "\"object_bytes\":%lld,\"text_bytes\":%lld}\n",
+                  mode, sites, seconds, file_size(base + ".o"),
+                  text_size(base + ".o", work));
+      std::fflush(stdout);
+    }
+  }
+}
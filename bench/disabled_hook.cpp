@@ -0,0 +1,52 @@
+// Part of Measurement Kit <https://measurement-kit.github.io/>.
+// Measurement Kit is free software under the BSD license. See AUTHORS
+// and LICENSE for more information on the copying conditions.
+
+// Compares the cost of MKMOCK_HOOK_DISABLED with the cost of a compiled
+// in MKMOCK_HOOK_ENABLED whose hook is not enabled. Build with:
+//
+//     c++ -std=c++11 -O2 -I. bench/disabled_hook.cpp -o disabled_hook -pthread
+
+#include "mkmock.hpp"
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+
+MKMOCK_DEFINE_HOOK(bench_disabled, int);
+
+static volatile int source = 0;
+static volatile int sink = 0;
+
+static void with_disabled_hook() {
+  int rv = source;
+  MKMOCK_HOOK_DISABLED(bench_disabled, rv);
+  sink = rv;
+}
+
+static void with_enabled_hook() {
+  int rv = source;
+  MKMOCK_HOOK_ENABLED(bench_disabled, rv);
+  sink = rv;
+}
+
+template <typename Func>
+static double ns_per_call(Func func, uint64_t iterations) {
+  auto begin = std::chrono::steady_clock::now();
+  for (uint64_t i = 0; i < iterations; ++i) {
+    func();
+  }
+  auto elapsed = std::chrono::steady_clock::now() - begin;
+  return std::chrono::duration<double, std::nano>(elapsed).count() / iterations;
+}
+
+int main() {
+  constexpr uint64_t iterations = 100000000;
+  for (int round = 0; round < 3; ++round) {
+    double disabled = ns_per_call(with_disabled_hook, iterations);
+    double enabled = ns_per_call(with_enabled_hook, iterations);
+    std::printf("round=%d MKMOCK_HOOK_DISABLED=%.3f ns "
+                "MKMOCK_HOOK_ENABLED(off)=%.3f ns\n",
+                round, disabled, enabled);
+  }
+}
@@ -0,0 +1,68 @@
+// Part of Measurement Kit <https://measurement-kit.github.io/>.
+// Measurement Kit is free software under the BSD license. See AUTHORS
+// and LICENSE for more information on the copying conditions.
+
+// Measures the cost of a disabled and of an enabled hook site when many
+// threads reach it concurrently. Build it with and without counters and
+// compare the results:
+//
+//     c++ -std=c++11 -O2 -I. bench/hook_counters.cpp -o hook_counters -pthread
+//     c++ -std=c++11 -O2 -I. -DMKMOCK_ENABLE_COUNTERS bench/hook_counters.cpp -o hook_counters_enabled -pthread
+
+#include "mkmock.hpp"
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <thread>
+#include <vector>
+
+MKMOCK_DEFINE_HOOK(bench_counted, int);
+
+static int reach_hook(int value) {
+  MKMOCK_HOOK_ENABLED(bench_counted, value);
+  return value;
+}
+
+static double ns_per_hit(unsigned nthreads, uint64_t iterations) {
+  std::vector<std::thread> threads;
+  std::atomic<bool> start{false};
+  for (unsigned i = 0; i < nthreads; ++i) {
+    threads.emplace_back([&start, iterations]() {
+      while (!start.load()) {
+        std::this_thread::yield();
+      }
+      volatile int sink = 0;
+      for (uint64_t j = 0; j < iterations; ++j) {
+        sink = reach_hook(static_cast<int>(j));
+      }
+      (void)sink;
+    });
+  }
+  auto begin = std::chrono::steady_clock::now();
+  start = true;
+  for (auto &thread : threads) {
+    thread.join();
+  }
+  auto elapsed = std::chrono::steady_clock::now() - begin;
+  return std::chrono::duration<double, std::nano>(elapsed).count() /
+         (static_cast<double>(iterations) * nthreads);
+}
+
+int main() {
+  constexpr uint64_t iterations = 10000000;
+#ifdef MKMOCK_ENABLE_COUNTERS
+  const char *mode = "counters";
+#else
+  const char *mode = "plain";
+#endif
+  for (unsigned nthreads : {1u, 2u, 4u, 8u, 16u, 32u, 64u}) {
+    double disabled = ns_per_hit(nthreads, iterations);
+    double enabled = 0.0;
+    MKMOCK_WITH_ENABLED_HOOK(bench_counted, 17, {
+      enabled = ns_per_hit(nthreads, iterations);
+    });
+    std::printf("mode=%s threads=%u disabled=%.3f ns enabled=%.3f ns\n",
+                mode, nthreads, disabled, enabled);
+  }
+}
@@ -0,0 +1,171 @@
+// Part of Measurement Kit <https://measurement-kit.github.io/>.
+// Measurement Kit is free software under the BSD license. See AUTHORS
+// and LICENSE for more information on the copying conditions.
+
+// Measures the cost per hit of a hook site when the hook is disabled, when
+// each thread reaches its own enabled hook (uncontended) and when all the
+// threads reach the same enabled hook (contended), for 1 to N threads and
+// for int, pointer and std::string values. Prints one JSON object per line
+// so that results can be tracked over time. Usage:
+//
+//     hook_overhead [max-threads [iterations-per-thread]]
+//
+// Build with:
+//
+//     c++ -std=c++11 -O2 -I. bench/hook_overhead.cpp -o hook_overhead -pthread
+
+#include "mkmock.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <thread>
+#include <vector>
+
+// The hooks are indexed, so that each thread may reach its own hook.
+template <typename Type, unsigned Index>
+class slot_hook : public mkmock::basic_hook<slot_hook<Type, Index>, Type> {};
+
+constexpr unsigned max_slots = 64;
+
+template <typename Type>
+struct slot_functions {
+  Type (*reach)(Type);
+  void (*enable)(const Type &);
+  void (*disable)();
+};
+
+template <typename Type, unsigned Index>
+static Type reach_slot(Type value) {
+  mkmock::hook<slot_hook<Type, Index>>(value);
+  return value;
+}
+
+template <typename Type, unsigned Index>
+static void enable_slot(const Type &value) {
+  using hook = slot_hook<Type, Index>;
+  hook::singleton()->mutex.lock();
+  hook::singleton()->mock(value);
+  hook::singleton()->arm();
+}
+
+template <typename Type, unsigned Index>
+static void disable_slot() {
+  using hook = slot_hook<Type, Index>;
+  hook::singleton()->disarm();
+  hook::singleton()->restore();
+  hook::singleton()->mutex.unlock();
+}
+
+template <typename Type, unsigned Count>
+struct slot_table {
+  static void fill(slot_functions<Type> *table) {
+    table[Count - 1] = slot_functions<Type>{&reach_slot<Type, Count - 1>,
+                                            &enable_slot<Type, Count - 1>,
+                                            &disable_slot<Type, Count - 1>};
+    slot_table<Type, Count - 1>::fill(table);
+  }
+};
+
+template <typename Type>
+struct slot_table<Type, 0> {
+  static void fill(slot_functions<Type> *) {}
+};
+
+enum class mode { disabled, uncontended, contended };
+
+static const char *mode_name(mode which) {
+  switch (which) {
+    case mode::disabled:
+      return "disabled";
+    case mode::uncontended:
+      return "enabled_uncontended";
+    case mode::contended:
+      return "enabled_contended";
+  }
+  return "";
+}
+
+template <typename Type>
+static double ns_per_hit(const slot_functions<Type> *table, mode which,
+                         unsigned nthreads, std::uint64_t iterations,
+                         const Type &real, const Type &mocked) {
+  unsigned nslots = (which == mode::uncontended) ? nthreads : 1;
+  if (which != mode::disabled) {
+    for (unsigned i = 0; i < nslots; ++i) {
+      table[i].enable(mocked);
+    }
+  }
+  std::vector<std::thread> threads;
+  std::atomic<bool> start{false};
+  std::atomic<unsigned> overridden{0};
+  for (unsigned i = 0; i < nthreads; ++i) {
+    Type (*reach)(Type) = table[(which == mode::uncontended) ? i : 0].reach;
+    threads.emplace_back([&start, &overridden, &real, &mocked, reach,
+                          iterations]() {
+      while (!start.load()) {
+        std::this_thread::yield();
+      }
+      unsigned count = 0;
+      for (std::uint64_t j = 0; j < iterations; ++j) {
+        count += (reach(real) == mocked);
+      }
+      overridden += count;
+    });
+  }
+  auto begin = std::chrono::steady_clock::now();
+  start = true;
+  for (auto &thread : threads) {
+    thread.join();
+  }
+  auto elapsed = std::chrono::steady_clock::now() - begin;
+  if (which != mode::disabled) {
+    for (unsigned i = nslots; i > 0; --i) {
+      table[i - 1].disable();
+    }
+  }
+  return std::chrono::duration<double, std::nano>(elapsed).count() /
+         (static_cast<double>(iterations) * nthreads);
+}
+
+template <typename Type>
+static void run(const char *type, unsigned max_threads,
+                std::uint64_t iterations, const Type &real,
+                const Type &mocked) {
+  slot_functions<Type> table[max_slots];
+  slot_table<Type, max_slots>::fill(table);
+  for (mode which : {mode::disabled, mode::uncontended, mode::contended}) {
+    for (unsigned nthreads = 1; nthreads <= max_threads; nthreads *= 2) {
+      double result =
+          ns_per_hit(table, which, nthreads, iterations, real, mocked);
+      std::printf("{\"benchmark\":\"hook_overhead\",\"mode\":\"%s\","
+                  "\"type\":\"%s\",\"threads\":%u,\"iterations\":%llu,"
+                  "\"ns_per_hit\":%.3f}\n",
+                  mode_name(which), type, nthreads,
+                  static_cast<unsigned long long>(iterations), result);
+      std::fflush(stdout);
+    }
+  }
+}
+
+int main(int argc, char **argv) {
+  unsigned max_threads = std::thread::hardware_concurrency();
+  if (argc > 1) {
+    max_threads = static_cast<unsigned>(std::atoi(argv[1]));
+  }
+  if (max_threads < 1 || max_threads > max_slots) {
+    max_threads = (max_threads < 1) ? 1 : max_slots;
+  }
+  std::uint64_t iterations = 1000000;
+  if (argc > 2) {
+    iterations = std::strtoull(argv[2], nullptr, 10);
+  }
+  static int object = 0;
+  run<int>("int", max_threads, iterations, 0, 17);
+  run<void *>("pointer", max_threads, iterations, &object, nullptr);
+  run<std::string>("string", max_threads, iterations, std::string{"real"},
+                   std::string{"a mocked value too long for small strings"});
+}
@@ -0,0 +1,173 @@
+// Part of Measurement Kit <https://measurement-kit.github.io/>.
+// Measurement Kit is free software under the BSD license. See AUTHORS
+// and LICENSE for more information on the copying conditions.
+
+// Stresses hooks with many threads reaching them while other threads
+// repeatedly enter and leave MKMOCK_WITH_ENABLED_HOOK for the same tags,
+// and reports, as one JSON object per line, the throughput, the latency
+// percentiles and Jain's fairness index across threads of both hits and
+// scope entries. Usage:
+//
+//     scope_stress [hitter-threads [scope-threads [milliseconds]]]
+//
+// Build with:
+//
+//     c++ -std=c++11 -O2 -I. bench/scope_stress.cpp -o scope_stress -pthread
+
+#include "mkmock.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <thread>
+#include <vector>
+
+MKMOCK_DEFINE_HOOK(stress_int, int);
+MKMOCK_DEFINE_HOOK(stress_string, std::string);
+
+using clock_type = std::chrono::steady_clock;
+
+// Only one hit every sample_every is timed, to keep the clock reads from
+// dominating the cost of hits.
+constexpr unsigned sample_every = 16;
+
+struct thread_stats {
+  std::uint64_t operations = 0;
+  std::vector<std::int64_t> latencies;
+};
+
+static std::int64_t ns_since(clock_type::time_point begin) {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             clock_type::now() - begin)
+      .count();
+}
+
+static void hit(unsigned index, std::atomic<bool> &stop, thread_stats &stats) {
+  volatile int int_sink = 0;
+  std::string string_sink;
+  while (!stop.load(std::memory_order_relaxed)) {
+    for (unsigned i = 0; i < sample_every; ++i) {
+      clock_type::time_point begin;
+      if (i == 0) {
+        begin = clock_type::now();
+      }
+      if (index % 2 == 0) {
+        int value = 0;
+        MKMOCK_HOOK_ENABLED(stress_int, value);
+        int_sink = value;
+      } else {
+        std::string value = "real";
+        MKMOCK_HOOK_ENABLED(stress_string, value);
+        string_sink = std::move(value);
+      }
+      if (i == 0) {
+        stats.latencies.push_back(ns_since(begin));
+      }
+    }
+    stats.operations += sample_every;
+  }
+  (void)int_sink;
+}
+
+static void enter_scopes(unsigned index, std::atomic<bool> &stop,
+                         thread_stats &stats) {
+  while (!stop.load(std::memory_order_relaxed)) {
+    clock_type::time_point begin = clock_type::now();
+    std::int64_t waited = 0;
+    if (index % 2 == 0) {
+      MKMOCK_WITH_ENABLED_HOOK(stress_int, 17, {
+        waited = ns_since(begin);
+        std::this_thread::yield();
+      });
+    } else {
+      MKMOCK_WITH_ENABLED_HOOK(stress_string, std::string{"mocked"}, {
+        waited = ns_since(begin);
+        std::this_thread::yield();
+      });
+    }
+    stats.latencies.push_back(waited);
+    stats.operations += 1;
+  }
+}
+
+static double jain_fairness(const std::vector<thread_stats> &stats) {
+  double sum = 0.0;
+  double sum_squares = 0.0;
+  for (const thread_stats &entry : stats) {
+    double value = static_cast<double>(entry.operations);
+    sum += value;
+    sum_squares += value * value;
+  }
+  return (sum_squares > 0.0)
+             ? (sum * sum) / (static_cast<double>(stats.size()) * sum_squares)
+             : 0.0;
+}
+
+static void report(const char *what, const std::vector<thread_stats> &stats,
+                   double seconds) {
+  std::vector<std::int64_t> latencies;
+  std::uint64_t operations = 0;
+  for (const thread_stats &entry : stats) {
+    operations += entry.operations;
+    latencies.insert(latencies.end(), entry.latencies.begin(),
+                     entry.latencies.end());
+  }
+  std::sort(latencies.begin(), latencies.end());
+  auto percentile = [&latencies](double p) -> std::int64_t {
+    if (latencies.empty()) {
+      return 0;
+    }
+    size_t index =
+        static_cast<size_t>(p * static_cast<double>(latencies.size() - 1));
+    return latencies[index];
+  };
+  std::printf("{\"benchmark\":\"scope_stress\",\"what\":\"%s\","
+              "\"threads\":%zu,\"operations\":%llu,"
+              "\"per_second\":%.1f,\"p50_ns\":%lld,\"p99_ns\":%lld,"
+              "\"max_ns\":%lld,\"fairness\":%.4f}\n",
+              what, stats.size(), static_cast<unsigned long long>(operations),
+              static_cast<double>(operations) / seconds,
+              static_cast<long long>(percentile(0.50)),
+              static_cast<long long>(percentile(0.99)),
+              static_cast<long long>(percentile(1.0)), jain_fairness(stats));
+}
+
+int main(int argc, char **argv) {
+  unsigned hitters = 256;
+  if (argc > 1) {
+    hitters = static_cast<unsigned>(std::atoi(argv[1]));
+  }
+  unsigned scopers = 8;
+  if (argc > 2) {
+    scopers = static_cast<unsigned>(std::atoi(argv[2]));
+  }
+  int milliseconds = (argc > 3) ? std::atoi(argv[3]) : 2000;
+  std::vector<thread_stats> hit_stats(hitters);
+  std::vector<thread_stats> scope_stats(scopers);
+  std::atomic<bool> stop{false};
+  std::vector<std::thread> threads;
+  for (unsigned i = 0; i < hitters; ++i) {
+    threads.emplace_back([i, &stop, &hit_stats]() {
+      hit(i, stop, hit_stats[i]);
+    });
+  }
+  for (unsigned i = 0; i < scopers; ++i) {
+    threads.emplace_back([i, &stop, &scope_stats]() {
+      enter_scopes(i, stop, scope_stats[i]);
+    });
+  }
+  clock_type::time_point begin = clock_type::now();
+  std::this_thread::sleep_for(std::chrono::milliseconds(milliseconds));
+  stop = true;
+  for (auto &thread : threads) {
+    thread.join();
+  }
+  double seconds =
+      std::chrono::duration<double>(clock_type::now() - begin).count();
+  report("hits", hit_stats, seconds);
+  report("scopes", scope_stats, seconds);
+}
@@ -0,0 +1,103 @@
+// Part of Measurement Kit <https://measurement-kit.github.io/>.
+// Measurement Kit is free software under the BSD license. See AUTHORS
+// and LICENSE for more information on the copying conditions.
+
+// Checks that the snapshots of a std::string hook are never freed while a
+// hook site is still copying them. Many threads reach the hook while other
+// threads enter and leave MKMOCK_WITH_ENABLED_HOOK back to back, so that
+// each snapshot is replaced twice in quick succession, and every thread
+// checks that it sees either the real value or a mocked one. It is meant
+// to be built with -fsanitize=address or -fsanitize=thread, which turn a
+// snapshot freed too early into a failure. Usage:
+//
+//     snapshot_stress [hitter-threads [scope-threads [milliseconds]]]
+//
+// Build with:
+//
+//     c++ -std=c++11 -O1 -g -fsanitize=address -I. bench/snapshot_stress.cpp -o snapshot_stress -pthread
+
+#include "mkmock.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <thread>
+#include <vector>
+
+MKMOCK_DEFINE_HOOK(snapshot_string, std::string);
+
+// Long enough not to fit in the small string buffer, so that copying a
+// freed snapshot reads freed heap memory.
+static const std::string real_value(64, 'r');
+static const std::string mocked_value(64, 'm');
+static const std::string sequence_value(64, 's');
+
+static std::atomic<std::uint64_t> failures{0};
+
+static void hit(std::atomic<bool> &stop, std::atomic<std::uint64_t> &hits) {
+  std::uint64_t count = 0;
+  while (!stop.load(std::memory_order_relaxed)) {
+    std::string value = real_value;
+    MKMOCK_HOOK_ENABLED(snapshot_string, value);
+    if (value != real_value && value != mocked_value &&
+        value != sequence_value) {
+      failures.fetch_add(1);
+    }
+    ++count;
+  }
+  hits.fetch_add(count);
+}
+
+static void enter_scopes(unsigned index, std::atomic<bool> &stop,
+                         std::atomic<std::uint64_t> &scopes) {
+  std::uint64_t count = 0;
+  while (!stop.load(std::memory_order_relaxed)) {
+    if (index % 2 == 0) {
+      MKMOCK_WITH_ENABLED_HOOK(snapshot_string, mocked_value, {});
+    } else {
+      MKMOCK_WITH_ENABLED_HOOK(
+          snapshot_string,
+          (mkmock::sequence<std::string>{sequence_value, sequence_value}), {});
+    }
+    ++count;
+  }
+  scopes.fetch_add(count);
+}
+
+int main(int argc, char **argv) {
+  unsigned hitters = 8;
+  if (argc > 1) {
+    hitters = static_cast<unsigned>(std::atoi(argv[1]));
+  }
+  unsigned scopers = 2;
+  if (argc > 2) {
+    scopers = static_cast<unsigned>(std::atoi(argv[2]));
+  }
+  int milliseconds = (argc > 3) ? std::atoi(argv[3]) : 2000;
+  std::atomic<bool> stop{false};
+  std::atomic<std::uint64_t> hits{0};
+  std::atomic<std::uint64_t> scopes{0};
+  std::vector<std::thread> threads;
+  for (unsigned i = 0; i < hitters; ++i) {
+    threads.emplace_back([&stop, &hits]() { hit(stop, hits); });
+  }
+  for (unsigned i = 0; i < scopers; ++i) {
+    threads.emplace_back([i, &stop, &scopes]() {
+      enter_scopes(i, stop, scopes);
+    });
+  }
+  std::this_thread::sleep_for(std::chrono::milliseconds(milliseconds));
+  stop = true;
+  for (auto &thread : threads) {
+    thread.join();
+  }
+  std::printf("{\"benchmark\":\"snapshot_stress\",\"hits\":%llu,"
+              "\"scopes\":%llu,\"failures\":%llu}\n",
+              static_cast<unsigned long long>(hits.load()),
+              static_cast<unsigned long long>(scopes.load()),
+              static_cast<unsigned long long>(failures.load()));
+  return (failures.load() == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -8,9 +8,180 @@
 ///
 /// This file contains common macros used for testing and mocking.
 
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
 #include <exception>
+#include <initializer_list>
+#include <memory>
 #include <mutex>
+#include <new>
+#include <type_traits>
 #include <utility>
+#include <vector>
+
+#ifdef __cpp_constinit
+#define MKMOCK_CONSTINIT constinit
+#else
+#define MKMOCK_CONSTINIT
+#endif
+
+#ifndef MKMOCK_HOOKS_COMPILED_IN
+/// MKMOCK_HOOKS_COMPILED_IN tells whether mkmock::hook compiles in the hooks
+/// for which mkmock::hook_compiled_in has not been specialized.
+#define MKMOCK_HOOKS_COMPILED_IN 1
+#endif
+
+#ifndef MKMOCK_CACHE_LINE
+/// MKMOCK_CACHE_LINE is the cache line size used to lay out hooks.
+#define MKMOCK_CACHE_LINE 64
+#endif
+
+#ifndef MKMOCK_MAX_COUNTED_HOOKS
+/// MKMOCK_MAX_COUNTED_HOOKS is the number of hooks for which counters are
+/// kept when MKMOCK_ENABLE_COUNTERS is defined. Hooks with larger IDs are
+/// not counted.
+#define MKMOCK_MAX_COUNTED_HOOKS 1024
+#endif
+
+#ifndef MKMOCK_TRACE_CAPACITY
+/// MKMOCK_TRACE_CAPACITY is the number of records kept by the trace ring
+/// of each thread when MKMOCK_ENABLE_TRACE is defined.
+#define MKMOCK_TRACE_CAPACITY 16384
+#endif
+
+#ifdef MKMOCK_ENABLE_TRACE
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <thread>
+#endif
+
+// Record and replay, enabled by MKMOCK_ENABLE_RECORD, and the control plane
+// keep their state in memory mapped files.
+#if (defined(MKMOCK_ENABLE_RECORD) || defined(MKMOCK_ENABLE_CONTROL)) && \
+    (defined(__unix__) || defined(__APPLE__))
+#define MKMOCK_HAVE_MMAP 1
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#if defined(MKMOCK_ENABLE_RECORD) && defined(MKMOCK_HAVE_MMAP)
+#define MKMOCK_HAVE_VALUE_LOG 1
+#include <map>
+#endif
+
+// Unlike std::mutex with libc++ and MSVC, pthread mutexes are trivially
+// destructible, hence hooks can use them without registering destructors.
+#if defined(__unix__) || defined(__APPLE__)
+#define MKMOCK_HAVE_PTHREAD_MUTEX 1
+#include <pthread.h>
+#include <sched.h>
+#else
+#include <thread>
+#endif
+
+#if defined(__GNUC__) && defined(__ELF__)
+#define MKMOCK_HAVE_HOOK_REGISTRY 1
+/// MKMOCK_HOOK_DESCRIPTOR emits the descriptor of the hook with tag @p Tag
+/// and type @p Type into the mkmock_hooks section, unless the hook is not
+/// compiled in. Descriptors are aligned to pointers to prevent the compiler
+/// from padding the section.
+#define MKMOCK_HOOK_DESCRIPTOR(Tag, Type)                            \
+  static mkmock::hook_registration<                                  \
+      mkmock::hook_compiled_in<mkmock_##Tag>::value>                 \
+      mkmock_descriptor_##Tag __attribute__((                        \
+          used, section("mkmock_hooks"), aligned(sizeof(void *)))) = \
+          mkmock::describe_hook<mkmock_##Tag>(                       \
+              #Tag, sizeof(Type), __FILE__, __LINE__,                \
+              mkmock::hook_compiled_in<mkmock_##Tag>{})
+#else
+#define MKMOCK_HOOK_DESCRIPTOR(Tag, Type) \
+  static_assert(true, "no hook registry")
+#endif
+
+#if defined(__GNUC__)
+#define MKMOCK_ALWAYS_INLINE inline __attribute__((always_inline))
+#define MKMOCK_COLD __attribute__((noinline, cold))
+#define MKMOCK_UNLIKELY(Condition) __builtin_expect(!!(Condition), 0)
+#else
+#define MKMOCK_ALWAYS_INLINE inline
+#define MKMOCK_COLD
+#define MKMOCK_UNLIKELY(Condition) (Condition)
+#endif
+
+#ifdef MKMOCK_ENABLE_CONFIG
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <string>
+#endif
+
+#ifndef MKMOCK_CONTROL_VALUE_SIZE
+/// MKMOCK_CONTROL_VALUE_SIZE is the maximum size of the values that can be
+/// set through the control plane enabled by MKMOCK_ENABLE_CONTROL.
+#define MKMOCK_CONTROL_VALUE_SIZE 64
+#endif
+
+#ifndef MKMOCK_CONTROL_INTERVAL
+/// MKMOCK_CONTROL_INTERVAL is how often, in milliseconds, the control plane
+/// enabled by MKMOCK_ENABLE_CONTROL polls its shared memory segment.
+#define MKMOCK_CONTROL_INTERVAL 10
+#endif
+
+#ifdef MKMOCK_ENABLE_CONTROL
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <string>
+#include <thread>
+#endif
+
+// Latency hooks and the virtual clock are enabled by MKMOCK_ENABLE_TIME.
+#ifdef MKMOCK_ENABLE_TIME
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <functional>
+#include <map>
+#include <thread>
+#endif
+
+// Jump sites start as NOPs, while MKMOCK_ENABLE_CONFIG needs hooks to start
+// armed, hence static keys are not used in such case.
+#if defined(MKMOCK_USE_STATIC_KEYS) && defined(__linux__) && \
+    (defined(__x86_64__) || defined(__aarch64__)) &&         \
+    (defined(__PIE__) || !defined(__PIC__)) && !defined(MKMOCK_ENABLE_CONFIG)
+#define MKMOCK_HAVE_STATIC_KEYS 1
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <cstdio>
+#include <cstdlib>
+
+
+#if defined(__x86_64__)
+#define MKMOCK_JUMP_SITE                        \
+  ".balign 8\n\t"                               \
+  "1: .byte 0x0f, 0x1f, 0x44, 0x00, 0x00\n\t"   \
+  ".pushsection mkmock_jump_table, \"aw?\"\n\t" \
+  ".balign 8\n\t"                               \
+  ".quad 1b, %l[l_armed], %c0\n\t"              \
+  ".popsection\n\t"
+#else
+#define MKMOCK_JUMP_SITE                        \
+  "1: nop\n\t"                                  \
+  ".pushsection mkmock_jump_table, \"aw?\"\n\t" \
+  ".balign 8\n\t"                               \
+  ".quad 1b, %l[l_armed], %c0\n\t"              \
+  ".popsection\n\t"
+#endif
+#endif
 
 /// MKMOCK_HOOK_DISABLED is a disabled hook for @p Tag and @p Variable.
 #define MKMOCK_HOOK_DISABLED(Tag, Variable)  // Nothing
@@ -30,84 +201,3096 @@
 ///   return;
 /// }
 /// ````
-#define MKMOCK_HOOK_ENABLED(Tag, Variable)                 \
-  do {                                                     \
-    mkmock_##Tag *inst = mkmock_##Tag::singleton();        \
-    std::unique_lock<std::recursive_mutex> _{inst->mutex}; \
-    if (inst->enabled) {                                   \
-      Variable = inst->value;                              \
-    }                                                      \
+///
+/// When compiling with MKMOCK_ENABLE_RECORD defined, while
+/// MKMOCK_WITH_RECORDING_HOOK is active, the value of @p Variable is
+/// appended to a mkmock::value_log before possibly overriding it.
+///
+/// The hook is checked with an atomic load before doing anything else, so
+/// a disabled hook costs a single predictable branch, and the rest of the
+/// work happens in a cold function shared by the sites of the hook. When
+/// compiling with MKMOCK_USE_STATIC_KEYS defined, Linux x86-64 and aarch64
+/// executables that are not position independent or are PIE replace such
+/// check with a NOP that is patched into a jump when the hook is enabled.
+#define MKMOCK_HOOK_ENABLED(Tag, Variable)          \
+  do {                                              \
+    if (MKMOCK_UNLIKELY(mkmock_##Tag::reached())) { \
+      mkmock_##Tag::slow_path(Variable);            \
+    }                                               \
   } while (0)
 
 /// MKMOCK_HOOK_ALLOC_ENABLED is like MKMOCK_HOOK_ENABLED except that it
 /// uses a @p Deleter to be called to free allocated memory when we want to
 /// make a successful memory allocation look like a failure. Without
-/// using this macro, `asan` will complain about a memory leak.
-#define MKMOCK_HOOK_ALLOC_ENABLED(Tag, Variable, Deleter)  \
-  do {                                                     \
-    mkmock_##Tag *inst = mkmock_##Tag::singleton();        \
-    std::unique_lock<std::recursive_mutex> _{inst->mutex}; \
-    if (inst->enabled) {                                   \
-      if (Variable != nullptr) {                           \
-        Deleter(Variable);                                 \
-      }                                                    \
-      Variable = inst->value;                              \
-    }                                                      \
+/// using this macro, `asan` will complain about a memory leak. Since @p
+/// Deleter may refer to local variables, e.g. `pool.release`, each site
+/// has its own cold function, rather than sharing it with other sites.
+#define MKMOCK_HOOK_ALLOC_ENABLED(Tag, Variable, Deleter)       \
+  do {                                                          \
+    if (MKMOCK_UNLIKELY(mkmock_##Tag::reached())) {             \
+      mkmock_##Tag::slow_path_alloc(                            \
+          Variable, [&](decltype((Variable)) mkmock_variable) { \
+            Deleter(mkmock_variable);                           \
+          });                                                   \
+    }                                                           \
+  } while (0)
+
+/// MKMOCK_DELAY_DISABLED is a disabled latency hook for @p Tag.
+#define MKMOCK_DELAY_DISABLED(Tag)  // Nothing
+
+#ifdef MKMOCK_ENABLE_TIME
+/// MKMOCK_DELAY_ENABLED provides you a latency hook identified by the @p Tag
+/// unique tag, whose type must be mkmock::delay. When the hook is enabled,
+/// the calling thread is delayed as described by the mocked mkmock::delay:
+///
+/// ```
+/// MKMOCK_DELAY_ENABLED(before_send);
+/// ssize_t rv = send(sock, buf, count, 0);
+/// ```
+///
+/// Latency hooks, like the virtual clock, require MKMOCK_ENABLE_TIME.
+#define MKMOCK_DELAY_ENABLED(Tag)                   \
+  do {                                              \
+    if (MKMOCK_UNLIKELY(mkmock_##Tag::reached())) { \
+      mkmock_##Tag::slow_path_delay();              \
+    }                                               \
   } while (0)
 
+/// MKMOCK_WITH_VIRTUAL_CLOCK runs @p CodeSnippet while mkmock::clock reads
+/// the mkmock::virtual_clock, so that tests can advance time instantly:
+///
+/// ```
+/// MKMOCK_WITH_VIRTUAL_CLOCK({
+///   std::thread t{[]() { run_code_waiting_for_timeout(); }};
+///   mkmock::virtual_clock::advance(std::chrono::minutes(5));
+///   t.join();
+/// });
+/// ```
+#define MKMOCK_WITH_VIRTUAL_CLOCK(CodeSnippet) \
+  mkmock::with_virtual_clock([&]() { CodeSnippet })
+#endif  // MKMOCK_ENABLE_TIME
+
+/// MKMOCK_WITH_RECORDING_HOOK runs @p CodeSnippet while the sites of the
+/// hook identified by @p Tag append the values they see to @p Log, which is
+/// a std::shared_ptr<mkmock::value_log> returned by mkmock::value_log::create,
+/// without overriding them. Only trivially copyable values are recorded.
+/// Record and replay are available on POSIX systems when compiling with
+/// MKMOCK_ENABLE_RECORD defined; otherwise sites do not record anything.
+#define MKMOCK_WITH_RECORDING_HOOK(Tag, Log, CodeSnippet) \
+  mkmock::with_recording_hook<mkmock_##Tag>(Log, [&]() { CodeSnippet })
+
+/// MKMOCK_WITH_REPLAYING_HOOK runs @p CodeSnippet while the sites of the
+/// hook identified by @p Tag override their variables with the values that
+/// have been recorded for @p Tag into @p Log, which is a
+/// std::shared_ptr<mkmock::value_log> returned by mkmock::value_log::open,
+/// in the recorded order. Once these values are exhausted, the sites stop
+/// overriding their variables. Like MKMOCK_WITH_RECORDING_HOOK, it requires
+/// MKMOCK_ENABLE_RECORD.
+#define MKMOCK_WITH_REPLAYING_HOOK(Tag, Log, CodeSnippet) \
+  mkmock::with_replaying_hook<mkmock_##Tag>(Log, [&]() { CodeSnippet })
+
 /// MKMOCK_DEFINE_HOOK defines a hook with tag @p Tag and type @p Type. This
-/// macro should be used in the unit tests source file only.
-#define MKMOCK_DEFINE_HOOK(Tag, Type)  \
-  class mkmock_##Tag {                 \
-   public:                             \
-    static mkmock_##Tag *singleton() { \
-      static mkmock_##Tag instance;    \
-      return &instance;                \
-    }                                  \
-                                       \
-    bool enabled = false;              \
-    Type value = {};                   \
-    Type saved_value = {};             \
-    std::exception_ptr saved_exc;      \
-    std::recursive_mutex mutex;        \
+/// macro should be used in the unit tests source file only. The hook's
+/// state is constant initialized and trivially destructible, so neither
+/// startup, exit nor hook sites need to run any code for it. On ELF
+/// platforms, a hook that is compiled in according to hook_compiled_in is
+/// also described in a linker section, such that mkmock::registered_hooks
+/// can enumerate the hooks without them being registered at startup.
+#define MKMOCK_DEFINE_HOOK(Tag, Type)                                  \
+  class mkmock_##Tag : public mkmock::basic_hook<mkmock_##Tag, Type> { \
+   public:                                                             \
+    static const char *name() noexcept { return #Tag; }                \
+  };                                                                   \
+  MKMOCK_HOOK_DESCRIPTOR(Tag, Type)
+
+/// MKMOCK_COMPILE_HOOK specializes mkmock::hook_compiled_in for the hook
+/// with tag @p Tag to @p Value. Use it in the global namespace, before the
+/// MKMOCK_DEFINE_HOOK defining the hook, which only describes the hook in
+/// the hook registry if it is compiled in.
+#define MKMOCK_COMPILE_HOOK(Tag, Value)           \
+  class mkmock_##Tag;                             \
+  namespace mkmock {                              \
+  template <>                                     \
+  struct hook_compiled_in<mkmock_##Tag>           \
+      : std::integral_constant<bool, (Value)> {}; \
   }
 
 /// MKMOCK_WITH_ENABLED_HOOK runs @p CodeSnippet with the mock identified by
-/// @p Tag enabled and with its value set to @p MockedValue. When leaving this
-/// macro will disable the mock and set its value back to the old value, even
-/// when @p CodeSnippet throws an exception. Exceptions will be rethrown by
-/// this macro once the previous state has been reset.
-#define MKMOCK_WITH_ENABLED_HOOK(Tag, MockedValue, CodeSnippet)   \
-  /* Implementation note: this macro is written such that it   */ \
-  /* can call itself without triggering compiler warning about */ \
-  /* reusing the same names in a inner scope.                  */ \
-  do {                                                            \
-    {                                                             \
-      mkmock_##Tag *inst = mkmock_##Tag::singleton();             \
-      inst->mutex.lock(); /* Barrier for other threads */         \
-      inst->saved_exc = {};                                       \
-      inst->saved_value = inst->value;                            \
-      inst->value = MockedValue;                                  \
-      inst->enabled = true;                                       \
-    }                                                             \
-    try {                                                         \
-      CodeSnippet                                                 \
-    } catch (...) {                                               \
-      mkmock_##Tag *inst = mkmock_##Tag::singleton();             \
-      inst->saved_exc = std::current_exception();                 \
-    }                                                             \
-    {                                                             \
-      mkmock_##Tag *inst = mkmock_##Tag::singleton();             \
-      inst->enabled = false;                                      \
-      inst->value = inst->saved_value;                            \
-      inst->saved_value = {};                                     \
-      std::exception_ptr saved_exc;                               \
-      std::swap(saved_exc, inst->saved_exc);                      \
-      inst->mutex.unlock(); /* Allow another thread. */           \
-      if (saved_exc) {                                            \
-        std::rethrow_exception(saved_exc);                        \
-      }                                                           \
-    }                                                             \
+/// @p Tag enabled and with its value set to @p MockedValue, which may also be
+/// a mkmock::sequence of values to be consumed one per hit. A @p MockedValue
+/// of move only type, e.g. a std::unique_ptr, is moved into the variable at
+/// the first hit only. When leaving this macro will disable the mock and set
+/// its value back to the old value, even when @p CodeSnippet throws an
+/// exception. Exceptions will be rethrown by this macro once the previous
+/// state has been reset.
+///
+/// Other threads reaching the hook meanwhile see the mocked value without
+/// blocking, while MKMOCK_WITH_ENABLED_HOOK invocations for the same @p Tag
+/// in different threads are serialized. Use MKMOCK_WITH_THREAD_ENABLED_HOOK
+/// to change the value for the current thread only without serializing.
+#define MKMOCK_WITH_ENABLED_HOOK(Tag, MockedValue, CodeSnippet) \
+  MKMOCK_WITH_POLICY_ENABLED_HOOK(Tag, MockedValue, mkmock::policy{}, CodeSnippet)
+
+/// MKMOCK_WITH_POLICY_ENABLED_HOOK is like MKMOCK_WITH_ENABLED_HOOK except
+/// that the hook only overrides variables when @p Policy allows it, e.g.:
+///
+/// ```
+/// MKMOCK_WITH_POLICY_ENABLED_HOOK(connect, -1, mkmock::with_probability(0.001), {
+///   run_soak_test();
+/// });
+/// ```
+#define MKMOCK_WITH_POLICY_ENABLED_HOOK(Tag, MockedValue, Policy, CodeSnippet) \
+  /* Implementation note: this macro is written such that it   */              \
+  /* can call itself without triggering compiler warning about */              \
+  /* reusing the same names in a inner scope.                  */              \
+  do {                                                                         \
+    {                                                                          \
+      mkmock_##Tag *inst = mkmock_##Tag::singleton();                          \
+      inst->mutex.lock(); /* Barrier for other threads */                      \
+      inst->saved_exception() = {};                                            \
+      inst->load_config();                                                     \
+      inst->apply(Policy);                                                     \
+      inst->mock(MockedValue);                                                 \
+      inst->arm();                                                             \
+      inst->trace_scope(true);                                                 \
+    }                                                                          \
+    try {                                                                      \
+      CodeSnippet                                                              \
+    } catch (...) {                                                            \
+      mkmock_##Tag *inst = mkmock_##Tag::singleton();                          \
+      inst->saved_exception() = std::current_exception();                      \
+    }                                                                          \
+    {                                                                          \
+      mkmock_##Tag *inst = mkmock_##Tag::singleton();                          \
+      inst->trace_scope(false);                                                \
+      inst->disarm();                                                          \
+      inst->reset();                                                           \
+      std::exception_ptr saved_exc;                                            \
+      std::swap(saved_exc, inst->saved_exception());                           \
+      inst->mutex.unlock(); /* Allow another thread. */                        \
+      if (saved_exc) {                                                         \
+        std::rethrow_exception(saved_exc);                                     \
+      }                                                                        \
+    }                                                                          \
   } while (0)
 
+/// MKMOCK_WITH_THREAD_ENABLED_HOOK is like MKMOCK_WITH_ENABLED_HOOK except
+/// that @p MockedValue is only visible to the calling thread and that other
+/// threads are never blocked, so that independent tests may concurrently use
+/// the same @p Tag. Within @p CodeSnippet, MKMOCK_THREAD_HOOK_HANDLE returns
+/// a handle that MKMOCK_WITH_ADOPTED_HOOK may use to make the same value
+/// visible to another thread.
+#define MKMOCK_WITH_THREAD_ENABLED_HOOK(Tag, MockedValue, CodeSnippet) \
+  MKMOCK_WITH_ADOPTED_HOOK(Tag, mkmock_##Tag::make_handle(MockedValue), CodeSnippet)
+
+/// MKMOCK_THREAD_HOOK_HANDLE returns the handle of the innermost thread
+/// scope of @p Tag entered by the calling thread, or a null handle.
+#define MKMOCK_THREAD_HOOK_HANDLE(Tag) mkmock_##Tag::thread_handle()
+
+/// MKMOCK_WITH_ADOPTED_HOOK runs @p CodeSnippet with the hook identified by
+/// @p Tag enabled for the calling thread only, using the value of the @p
+/// Handle returned by MKMOCK_THREAD_HOOK_HANDLE in another thread. A null
+/// @p Handle, returned when the other thread has no thread scope, does not
+/// enable the hook, hence @p CodeSnippet sees the same values it would see
+/// without this macro.
+#define MKMOCK_WITH_ADOPTED_HOOK(Tag, Handle, CodeSnippet) \
+  do {                                                     \
+    mkmock_##Tag::singleton()->push_thread_scope(Handle);  \
+    try {                                                  \
+      CodeSnippet                                          \
+    } catch (...) {                                        \
+      mkmock_##Tag::save_thread_exception();               \
+    }                                                      \
+    mkmock_##Tag::singleton()->pop_thread_scope();         \
+  } while (0)
+
+namespace mkmock {
+
+/// yield_thread lets other threads run before the calling one.
+inline void yield_thread() noexcept {
+#ifdef MKMOCK_HAVE_PTHREAD_MUTEX
+  sched_yield();
+#else
+  std::this_thread::yield();
+#endif
+}
+
+/// seqlock publishes a trivially copyable @p Type, which may also be absent,
+/// such that readers never block each other or the writer. Writers must be
+/// serialized by the caller, e.g. by holding the mutex of the hook.
+template <typename Type>
+class seqlock {
+ public:
+  /// visit calls @p func with a consistent copy of the value and returns
+  /// true, or returns false without calling @p func if there is no value.
+  template <typename Func>
+  bool visit(Func &&func) const {
+    word copy[nwords];
+    for (;;) {
+      unsigned begin = seq_.load(std::memory_order_acquire);
+      if ((begin & writing) != 0) {
+        continue;
+      }
+      if ((begin & present) == 0) {
+        return false;
+      }
+      for (size_t i = 0; i < nwords; ++i) {
+        copy[i] = words_[i].load(std::memory_order_relaxed);
+      }
+      std::atomic_thread_fence(std::memory_order_acquire);
+      if (seq_.load(std::memory_order_relaxed) == begin) {
+        break;
+      }
+    }
+    Type value;
+    std::memcpy(&value, copy, sizeof(value));
+    std::forward<Func>(func)(static_cast<const Type &>(value));
+    return true;
+  }
+
+  /// publish makes @p value visible to readers.
+  void publish(const Type &value) noexcept {
+    word copy[nwords] = {};
+    std::memcpy(copy, &value, sizeof(value));
+    unsigned begin = seq_.load(std::memory_order_relaxed);
+    seq_.store(begin | writing, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    for (size_t i = 0; i < nwords; ++i) {
+      words_[i].store(copy[i], std::memory_order_relaxed);
+    }
+    seq_.store(((begin & ~flags) + version) | present, std::memory_order_release);
+  }
+
+  /// retract tells readers that there is no value.
+  void retract() noexcept {
+    unsigned begin = seq_.load(std::memory_order_relaxed);
+    seq_.store((begin & ~flags) + version, std::memory_order_release);
+  }
+
+ private:
+  using word = std::uintptr_t;
+  static constexpr size_t nwords = (sizeof(Type) + sizeof(word) - 1) / sizeof(word);
+  static constexpr unsigned writing = 1;
+  static constexpr unsigned present = 2;
+  static constexpr unsigned flags = writing | present;
+  static constexpr unsigned version = 4;
+  std::atomic<unsigned> seq_{0};
+  std::atomic<word> words_[nwords] = {};
+};
+
+/// snapshot publishes an immutable @p Type, which may also be absent, such
+/// that readers do not need to lock. Readers announce
+/// themselves in the counter of the current epoch, and announce again if
+/// the epoch changed meanwhile, as no writer would wait for them; a writer
+/// replacing the snapshot starts a new epoch and waits for the readers of
+/// the previous one to leave before deleting the old snapshot. Writers must
+/// be serialized by the caller, e.g. by holding the mutex of the hook.
+///
+/// A snapshot is trivially destructible, so that hooks need no destructor
+/// to run at exit. The current snapshot, if any, is deleted only when it
+/// is replaced, hence the last writer should publish null.
+template <typename Type>
+class snapshot {
+ public:
+  /// visit calls @p func with the current snapshot and returns true, or
+  /// returns false without calling @p func if there is no snapshot. Since
+  /// writers wait for @p func to return, it should only copy or move what
+  /// it needs out of the snapshot, e.g. into a value_slot.
+  template <typename Func>
+  bool visit(Func &&func) const {
+    if (current_.load(std::memory_order_relaxed) == nullptr) {
+      return false;  // Avoid touching the epoch counters when unused
+    }
+    reader_guard guard{epoch_, readers_};
+    const Type *current = current_.load();
+    if (current == nullptr) {
+      return false;
+    }
+    std::forward<Func>(func)(*current);
+    return true;
+  }
+
+  /// publish makes @p value the current snapshot, or tells readers that
+  /// there is no snapshot if @p value is null. When this function returns
+  /// no reader can still be using the previous snapshot.
+  void publish(std::unique_ptr<const Type> value) {
+    // The old snapshot is deleted when returning, after its readers left.
+    std::unique_ptr<const Type> old{current_.exchange(value.release())};
+    unsigned previous = epoch_.fetch_add(1);
+    while (readers_[previous & 1].load() != 0) {
+      yield_thread();
+    }
+  }
+
+ private:
+  class reader_guard {
+   public:
+    reader_guard(const std::atomic<unsigned> &epoch,
+                 std::atomic<unsigned> (&readers)[2]) noexcept {
+      unsigned current = epoch.load();
+      for (;;) {
+        counter_ = &readers[current & 1];
+        counter_->fetch_add(1);
+        unsigned again = epoch.load();
+        if (again == current) {
+          break;
+        }
+        counter_->fetch_sub(1, std::memory_order_release);
+        current = again;
+      }
+    }
+    ~reader_guard() noexcept { counter_->fetch_sub(1, std::memory_order_release); }
+    reader_guard(const reader_guard &) = delete;
+    reader_guard &operator=(const reader_guard &) = delete;
+
+   private:
+    std::atomic<unsigned> *counter_;
+  };
+
+  std::atomic<const Type *> current_{nullptr};
+  std::atomic<unsigned> epoch_{0};
+  mutable std::atomic<unsigned> readers_[2] = {};
+};
+
+/// value_slot holds a value, if any, moved or copied out of a snapshot, so
+/// that the value can be used after leaving the snapshot.
+template <typename Type>
+class value_slot {
+ public:
+  value_slot() noexcept {}
+  value_slot(const value_slot &) = delete;
+  value_slot &operator=(const value_slot &) = delete;
+
+  ~value_slot() {
+    if (full_) {
+      get().~Type();
+    }
+  }
+
+  /// emplace stores @p value into the empty slot.
+  template <typename Value>
+  void emplace(Value &&value) {
+    new (&storage_) Type(std::forward<Value>(value));
+    full_ = true;
+  }
+
+  /// full returns whether the slot holds a value.
+  bool full() const noexcept { return full_; }
+
+  /// get returns the value held by the slot.
+  Type &get() noexcept { return *reinterpret_cast<Type *>(&storage_); }
+
+ private:
+  typename std::aligned_storage<sizeof(Type), alignof(Type)>::type storage_;
+  bool full_ = false;
+};
+
+#ifdef MKMOCK_HAVE_STATIC_KEYS
+/// jump_entry describes a jump site emitted by basic_hook::armed in the
+/// mkmock_jump_table section: the address of the NOP, the address where
+/// to jump when the hook is armed and the address of the hook's key.
+struct jump_entry {
+  std::uintptr_t code;
+  std::uintptr_t target;
+  std::uintptr_t key;
+};
+
+}  // namespace mkmock
+
+extern "C" {
+extern mkmock::jump_entry __start_mkmock_jump_table[]
+    __attribute__((weak, visibility("hidden")));
+extern mkmock::jump_entry __stop_mkmock_jump_table[]
+    __attribute__((weak, visibility("hidden")));
+}
+
+namespace mkmock {
+
+/// patch_jump_site turns the jump site described by @p entry into a jump
+/// if @p jump is true and into a NOP otherwise. On x86-64 the site is eight
+/// bytes aligned, so a single atomic store rewrites the whole instruction.
+/// ThreadSanitizer has no shadow memory for code, hence the store must not
+/// be instrumented.
+__attribute__((no_sanitize_thread)) inline void patch_jump_site(
+    const jump_entry &entry, bool jump) noexcept {
+  static const long page_size = sysconf(_SC_PAGESIZE);
+  std::uintptr_t page = entry.code & ~static_cast<std::uintptr_t>(page_size - 1);
+  if (mprotect(reinterpret_cast<void *>(page), static_cast<size_t>(page_size),
+               PROT_READ | PROT_WRITE | PROT_EXEC) != 0) {
+    std::perror("mkmock: mprotect");
+    std::abort();
+  }
+#if defined(__x86_64__)
+  auto code = reinterpret_cast<std::uint64_t *>(entry.code);
+  std::uint64_t insn = __atomic_load_n(code, __ATOMIC_RELAXED);
+  unsigned char *bytes = reinterpret_cast<unsigned char *>(&insn);
+  if (jump) {
+    auto offset = static_cast<std::int32_t>(entry.target - (entry.code + 5));
+    bytes[0] = 0xe9;
+    std::memcpy(&bytes[1], &offset, sizeof(offset));
+  } else {
+    static const unsigned char nop[] = {0x0f, 0x1f, 0x44, 0x00, 0x00};
+    std::memcpy(bytes, nop, sizeof(nop));
+  }
+  __atomic_store_n(code, insn, __ATOMIC_SEQ_CST);
+#elif defined(__aarch64__)
+  auto code = reinterpret_cast<std::uint32_t *>(entry.code);
+  std::uint32_t insn = 0xd503201f;
+  if (jump) {
+    auto offset = static_cast<std::int64_t>(entry.target - entry.code);
+    insn = 0x14000000 | (static_cast<std::uint32_t>(offset >> 2) & 0x03ffffff);
+  }
+  __atomic_store_n(code, insn, __ATOMIC_SEQ_CST);
+  __builtin___clear_cache(reinterpret_cast<char *>(code),
+                          reinterpret_cast<char *>(code + 1));
+#endif
+  if (mprotect(reinterpret_cast<void *>(page), static_cast<size_t>(page_size),
+               PROT_READ | PROT_EXEC) != 0) {
+    std::perror("mkmock: mprotect");
+    std::abort();
+  }
+}
+
+/// update_jump_sites patches all the jump sites of @p key such that they
+/// jump if @p enabled is nonzero. The value of @p enabled is read while
+/// holding a global lock, so concurrent updates converge.
+inline void update_jump_sites(const void *key, const std::atomic<unsigned> &enabled) noexcept {
+  static std::mutex mutex;
+  std::unique_lock<std::mutex> _{mutex};
+  bool jump = enabled.load() != 0;
+  for (jump_entry *entry = __start_mkmock_jump_table;
+       entry != nullptr && entry < __stop_mkmock_jump_table; ++entry) {
+    if (entry->key == reinterpret_cast<std::uintptr_t>(key)) {
+      patch_jump_site(*entry, jump);
+    }
+  }
+}
+#endif  // MKMOCK_HAVE_STATIC_KEYS
+
+/// plain_mutex is a mutex that, unlike std::mutex with some standard
+/// libraries, is trivially destructible. Where pthread mutexes are not
+/// available, it spins yielding to other threads.
+class plain_mutex {
+ public:
+#ifdef MKMOCK_HAVE_PTHREAD_MUTEX
+  void lock() noexcept { pthread_mutex_lock(&mutex_); }
+
+  bool try_lock() noexcept { return pthread_mutex_trylock(&mutex_) == 0; }
+
+  void unlock() noexcept { pthread_mutex_unlock(&mutex_); }
+
+ private:
+  pthread_mutex_t mutex_ = PTHREAD_MUTEX_INITIALIZER;
+#else
+  void lock() noexcept {
+    while (!try_lock()) {
+      yield_thread();
+    }
+  }
+
+  bool try_lock() noexcept {
+    return !locked_.load(std::memory_order_relaxed) &&
+           !locked_.exchange(true, std::memory_order_acquire);
+  }
+
+  void unlock() noexcept { locked_.store(false, std::memory_order_release); }
+
+ private:
+  std::atomic<bool> locked_{false};
+#endif
+};
+
+/// recursive_mutex is a recursive mutex that, unlike std::recursive_mutex,
+/// can be constant initialized and is trivially destructible.
+class recursive_mutex {
+ public:
+  void lock() {
+    const void *self = thread_id();
+    if (owner_.load(std::memory_order_relaxed) == self) {
+      ++depth_;
+      return;
+    }
+    mutex_.lock();
+    owner_.store(self, std::memory_order_relaxed);
+    depth_ = 1;
+  }
+
+  bool try_lock() {
+    const void *self = thread_id();
+    if (owner_.load(std::memory_order_relaxed) == self) {
+      ++depth_;
+      return true;
+    }
+    if (!mutex_.try_lock()) {
+      return false;
+    }
+    owner_.store(self, std::memory_order_relaxed);
+    depth_ = 1;
+    return true;
+  }
+
+  void unlock() {
+    if (--depth_ == 0) {
+      owner_.store(nullptr, std::memory_order_relaxed);
+      mutex_.unlock();
+    }
+  }
+
+ private:
+  static const void *thread_id() noexcept {
+    static thread_local char id;
+    return &id;
+  }
+
+  plain_mutex mutex_;
+  std::atomic<const void *> owner_{nullptr};
+  unsigned depth_ = 0;
+};
+
+/// static_instance holds the instance of @p Type, which must be
+/// constant initialized and trivially destructible, as a static data
+/// member, such that it needs neither a guard variable nor a constructor
+/// or destructor registered at startup.
+template <typename Type>
+struct static_instance {
+  static_assert(std::is_trivially_destructible<Type>::value,
+                "mkmock: static instances must be trivially destructible");
+  static Type value;
+};
+
+template <typename Type>
+MKMOCK_CONSTINIT Type static_instance<Type>::value;
+
+/// hook_ids assigns dense integer IDs to hooks and remembers their names.
+struct hook_ids {
+  std::mutex mutex;
+  unsigned count = 0;
+  std::vector<const char *> names;
+
+  /// get returns the process wide instance. It is never destroyed, so
+  /// that it outlives the threads and the std::atexit functions using it.
+  static hook_ids &get() noexcept {
+    static hook_ids *ids = new hook_ids;
+    return *ids;
+  }
+};
+
+#ifdef MKMOCK_ENABLE_COUNTERS
+/// hook_counters contains how many times the sites of a hook have been
+/// reached and how many times they have overridden a variable.
+struct hook_counters {
+  std::uint64_t hits = 0;
+  std::uint64_t overrides = 0;
+};
+
+/// counter_slab contains the counters of a thread indexed by hook ID. Only
+/// the owning thread writes the counters, so there is no contention on
+/// them and no need for atomic read-modify-write operations.
+struct counter_slab {
+  std::atomic<std::uint64_t> hits[MKMOCK_MAX_COUNTED_HOOKS];
+  std::atomic<std::uint64_t> overrides[MKMOCK_MAX_COUNTED_HOOKS];
+  counter_slab *next;
+  counter_slab *previous;
+};
+
+/// counter_registry contains the slabs of the running threads and the
+/// counters of the threads that have exited.
+struct counter_registry {
+  std::mutex mutex;
+  counter_slab *slabs = nullptr;
+  hook_counters retired[MKMOCK_MAX_COUNTED_HOOKS];
+
+  /// get returns the process wide instance. It is never destroyed, so
+  /// that it outlives the threads and the std::atexit functions using it.
+  static counter_registry &get() noexcept {
+    static counter_registry *registry = new counter_registry;
+    return *registry;
+  }
+};
+
+/// thread_counters owns the counter slab of the calling thread, which is
+/// created on first use and retired into the registry on thread exit.
+class thread_counters {
+ public:
+  /// increment increments the counter @p which of the hook @p id.
+  static void increment(std::atomic<std::uint64_t> (counter_slab::*which)[MKMOCK_MAX_COUNTED_HOOKS],
+                        unsigned id) {
+    counter_slab *slab = current();
+    if (slab == nullptr) {
+      slab = attach();
+    }
+    if (slab != nullptr && id < MKMOCK_MAX_COUNTED_HOOKS) {
+      std::atomic<std::uint64_t> &counter = (slab->*which)[id];
+      counter.store(counter.load(std::memory_order_relaxed) + 1,
+                    std::memory_order_relaxed);
+    }
+  }
+
+ private:
+  thread_counters() : slab_{new counter_slab()} {
+    counter_registry &registry = counter_registry::get();
+    std::unique_lock<std::mutex> _{registry.mutex};
+    slab_->next = registry.slabs;
+    if (registry.slabs != nullptr) {
+      registry.slabs->previous = slab_;
+    }
+    registry.slabs = slab_;
+    current() = slab_;
+  }
+
+  ~thread_counters() {
+    current() = nullptr;
+    exited() = true;
+    counter_registry &registry = counter_registry::get();
+    std::unique_lock<std::mutex> _{registry.mutex};
+    for (size_t i = 0; i < MKMOCK_MAX_COUNTED_HOOKS; ++i) {
+      registry.retired[i].hits += slab_->hits[i].load(std::memory_order_relaxed);
+      registry.retired[i].overrides += slab_->overrides[i].load(std::memory_order_relaxed);
+    }
+    if (slab_->previous != nullptr) {
+      slab_->previous->next = slab_->next;
+    } else {
+      registry.slabs = slab_->next;
+    }
+    if (slab_->next != nullptr) {
+      slab_->next->previous = slab_->previous;
+    }
+    delete slab_;
+  }
+
+  static counter_slab *&current() noexcept {
+    static thread_local counter_slab *slab = nullptr;
+    return slab;
+  }
+
+  static bool &exited() noexcept {
+    static thread_local bool value = false;
+    return value;
+  }
+
+  static counter_slab *attach() {
+    if (exited()) {
+      return nullptr;  // Hits during thread teardown are not counted
+    }
+    static thread_local thread_counters owner;
+    return owner.slab_;
+  }
+
+  counter_slab *slab_;
+};
+
+/// read_counters returns the counters of the hook @p id summed across the
+/// running threads and the threads that have exited.
+inline hook_counters read_counters(unsigned id) {
+  hook_counters result;
+  if (id >= MKMOCK_MAX_COUNTED_HOOKS) {
+    return result;
+  }
+  counter_registry &registry = counter_registry::get();
+  std::unique_lock<std::mutex> _{registry.mutex};
+  result = registry.retired[id];
+  for (counter_slab *slab = registry.slabs; slab != nullptr; slab = slab->next) {
+    result.hits += slab->hits[id].load(std::memory_order_relaxed);
+    result.overrides += slab->overrides[id].load(std::memory_order_relaxed);
+  }
+  return result;
+}
+#endif  // MKMOCK_ENABLE_COUNTERS
+
+/// hook_name returns the name of the hook with ID @p id, or nullptr if no
+/// hook has been assigned such ID yet.
+inline const char *hook_name(unsigned id) {
+  hook_ids &ids = hook_ids::get();
+  std::unique_lock<std::mutex> _{ids.mutex};
+  return (id < ids.names.size()) ? ids.names[id] : nullptr;
+}
+
+#ifdef MKMOCK_ENABLE_TRACE
+/// trace_kind is the kind of event described by a trace_record.
+enum class trace_kind : std::uint8_t {
+  hit = 0,       ///< A hook site has been reached without overriding.
+  override = 1,  ///< A hook site has been reached and has overridden.
+  scope_enter = 2,  ///< A scope enabling the hook has been entered.
+  scope_exit = 3,   ///< A scope enabling the hook has been left.
+};
+
+/// trace_record is a record of the binary trace written by dump_trace,
+/// which consists of a trace_header, followed by the hook names, each
+/// one as a 32 bit length followed by the name, followed by the records.
+/// All integers are stored in the host byte order.
+struct trace_record {
+  std::uint64_t timestamp;  ///< Ticks read by trace_timestamp.
+  std::uint32_t hook;       ///< ID of the hook.
+  std::uint16_t thread;     ///< Small integer identifying the thread.
+  std::uint8_t kind;        ///< The trace_kind of the event.
+  std::uint8_t reserved;
+};
+
+/// trace_header is the header of the binary trace written by dump_trace.
+struct trace_header {
+  char magic[8];                    ///< Always "MKMOCKTR".
+  std::uint32_t version;            ///< Currently 1.
+  std::uint32_t hooks;              ///< Number of hook names.
+  std::uint64_t ticks_per_second;   ///< Frequency of the timestamps.
+  std::uint64_t start;              ///< Timestamp when tracing started.
+  std::uint64_t records;            ///< Number of records.
+};
+
+/// trace_timestamp returns the time stamp counter where available and
+/// otherwise the nanoseconds of the steady clock.
+MKMOCK_ALWAYS_INLINE std::uint64_t trace_timestamp() noexcept {
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+  return __builtin_ia32_rdtsc();
+#elif defined(__GNUC__) && defined(__aarch64__)
+  std::uint64_t ticks;
+  asm volatile("mrs %0, cntvct_el0" : "=r"(ticks));
+  return ticks;
+#else
+  return static_cast<std::uint64_t>(
+      std::chrono::duration_cast<std::chrono::nanoseconds>(
+          std::chrono::steady_clock::now().time_since_epoch())
+          .count());
+#endif
+}
+
+/// trace_ring is the ring buffer where a thread appends its records. Only
+/// the owning thread writes it, while dump_trace may read it concurrently
+/// and discards the records that may have been overwritten meanwhile.
+struct trace_ring {
+  std::atomic<std::uint64_t> head;
+  std::atomic<std::uint64_t> words[2 * MKMOCK_TRACE_CAPACITY];
+  trace_ring *next;
+  bool busy;
+};
+
+/// trace_flag tells whether tracing is active.
+struct trace_flag {
+  std::atomic<bool> active{false};
+};
+
+/// trace_registry contains the rings of all the threads that have traced.
+/// The rings of the threads that have exited are reused by new threads.
+struct trace_registry {
+  std::mutex mutex;
+  trace_ring *rings = nullptr;
+  std::uint16_t threads = 0;
+  std::uint64_t start = 0;
+  std::chrono::steady_clock::time_point start_time;
+  std::string exit_path;
+
+  /// get returns the process wide instance. It is never destroyed, so
+  /// that it outlives the threads and the std::atexit functions using it.
+  static trace_registry &get() noexcept {
+    static trace_registry *registry = new trace_registry;
+    return *registry;
+  }
+};
+
+/// thread_trace owns the trace ring of the calling thread.
+class thread_trace {
+ public:
+  /// append appends a record of @p kind for @p Hook if tracing is active.
+  template <typename Hook>
+  MKMOCK_ALWAYS_INLINE static void append(trace_kind kind) {
+    if (static_instance<trace_flag>::value.active.load(
+            std::memory_order_relaxed)) {
+      write(Hook::singleton()->id(), kind);
+    }
+  }
+
+ private:
+  thread_trace() {
+    trace_registry &registry = trace_registry::get();
+    std::unique_lock<std::mutex> _{registry.mutex};
+    for (ring_ = registry.rings; ring_ != nullptr; ring_ = ring_->next) {
+      if (!ring_->busy) {
+        break;
+      }
+    }
+    if (ring_ == nullptr) {
+      ring_ = new trace_ring();
+      ring_->next = registry.rings;
+      registry.rings = ring_;
+    }
+    ring_->busy = true;
+    thread_ = registry.threads++;
+    current() = this;
+  }
+
+  ~thread_trace() {
+    current() = nullptr;
+    exited() = true;
+    trace_registry &registry = trace_registry::get();
+    std::unique_lock<std::mutex> _{registry.mutex};
+    ring_->busy = false;
+  }
+
+  static void write(unsigned hook, trace_kind kind) {
+    thread_trace *self = current();
+    if (self == nullptr) {
+      if (exited()) {
+        return;  // Hits during thread teardown are not traced
+      }
+      static thread_local thread_trace owner;
+      self = &owner;
+    }
+    trace_ring *ring = self->ring_;
+    std::uint64_t head = ring->head.load(std::memory_order_relaxed);
+    std::size_t slot = 2 * (head % MKMOCK_TRACE_CAPACITY);
+    // Orders the slot's stores after the previous head store, so that a
+    // reader that sees them also sees that the slot is being reused.
+    std::atomic_thread_fence(std::memory_order_release);
+    ring->words[slot].store(trace_timestamp(), std::memory_order_relaxed);
+    ring->words[slot + 1].store(
+        std::uint64_t{hook} | (std::uint64_t{self->thread_} << 32) |
+            (std::uint64_t{static_cast<std::uint8_t>(kind)} << 48),
+        std::memory_order_relaxed);
+    ring->head.store(head + 1, std::memory_order_release);
+  }
+
+  static thread_trace *&current() noexcept {
+    static thread_local thread_trace *self = nullptr;
+    return self;
+  }
+
+  static bool &exited() noexcept {
+    static thread_local bool value = false;
+    return value;
+  }
+
+  trace_ring *ring_;
+  std::uint16_t thread_;
+};
+
+/// start_trace starts recording hook hits into per thread rings. The
+/// timestamps of the first call are the origin of the trace.
+inline void start_trace() {
+  trace_registry &registry = trace_registry::get();
+  {
+    std::unique_lock<std::mutex> _{registry.mutex};
+    if (registry.start == 0) {
+      registry.start_time = std::chrono::steady_clock::now();
+      registry.start = trace_timestamp();
+    }
+  }
+  static_instance<trace_flag>::value.active.store(true,
+                                                  std::memory_order_relaxed);
+}
+
+/// stop_trace stops recording hook hits. Already recorded hits are kept.
+inline void stop_trace() noexcept {
+  static_instance<trace_flag>::value.active.store(false,
+                                                  std::memory_order_relaxed);
+}
+
+/// dump_trace writes the records currently held by the rings into the
+/// file at @p path and returns whether it succeeded. The records of each
+/// thread are in order, but the records of different threads are not
+/// merged. It is safe to call this function while threads are tracing.
+inline bool dump_trace(const char *path) {
+  trace_registry &registry = trace_registry::get();
+  std::unique_lock<std::mutex> lock{registry.mutex};
+  if (registry.start == 0) {
+    return false;
+  }
+  std::vector<trace_record> records;
+  std::vector<std::uint64_t> words(2 * MKMOCK_TRACE_CAPACITY);
+  for (trace_ring *ring = registry.rings; ring != nullptr; ring = ring->next) {
+    std::uint64_t head = ring->head.load(std::memory_order_acquire);
+    std::uint64_t first =
+        (head > MKMOCK_TRACE_CAPACITY) ? head - MKMOCK_TRACE_CAPACITY : 0;
+    for (std::uint64_t i = first; i < head; ++i) {
+      std::size_t slot = 2 * (i % MKMOCK_TRACE_CAPACITY);
+      words[slot] = ring->words[slot].load(std::memory_order_relaxed);
+      words[slot + 1] = ring->words[slot + 1].load(std::memory_order_relaxed);
+    }
+    std::atomic_thread_fence(std::memory_order_acquire);
+    // The writer may be overwriting the slot of the record at the head
+    // and has overwritten the ones before it.
+    std::uint64_t last = ring->head.load(std::memory_order_relaxed);
+    if (last + 1 > MKMOCK_TRACE_CAPACITY) {
+      first = (std::max)(first, last + 1 - MKMOCK_TRACE_CAPACITY);
+    }
+    for (std::uint64_t i = first; i < head; ++i) {
+      std::size_t slot = 2 * (i % MKMOCK_TRACE_CAPACITY);
+      trace_record record{};
+      record.timestamp = words[slot];
+      record.hook = static_cast<std::uint32_t>(words[slot + 1]);
+      record.thread = static_cast<std::uint16_t>(words[slot + 1] >> 32);
+      record.kind = static_cast<std::uint8_t>(words[slot + 1] >> 48);
+      records.push_back(record);
+    }
+  }
+  // Estimate the frequency of the timestamps over at least 10 ms.
+  std::chrono::steady_clock::time_point start_time = registry.start_time;
+  std::uint64_t start = registry.start;
+  lock.unlock();
+  std::this_thread::sleep_until(start_time + std::chrono::milliseconds(10));
+  std::chrono::nanoseconds elapsed =
+      std::chrono::steady_clock::now() - start_time;
+  std::uint64_t ticks = trace_timestamp() - start;
+  trace_header header{};
+  std::memcpy(header.magic, "MKMOCKTR", sizeof(header.magic));
+  header.version = 1;
+  header.ticks_per_second = static_cast<std::uint64_t>(
+      static_cast<double>(ticks) * 1e9 / static_cast<double>(elapsed.count()));
+  header.start = start;
+  header.records = records.size();
+  std::vector<const char *> names;
+  {
+    hook_ids &ids = hook_ids::get();
+    std::unique_lock<std::mutex> _{ids.mutex};
+    names = ids.names;
+  }
+  header.hooks = static_cast<std::uint32_t>(names.size());
+  std::FILE *filep = std::fopen(path, "wb");
+  if (filep == nullptr) {
+    return false;
+  }
+  bool ok = std::fwrite(&header, sizeof(header), 1, filep) == 1;
+  for (const char *name : names) {
+    std::uint32_t length = static_cast<std::uint32_t>(std::strlen(name));
+    ok = ok && std::fwrite(&length, sizeof(length), 1, filep) == 1 &&
+         std::fwrite(name, 1, length, filep) == length;
+  }
+  ok = ok && (records.empty() ||
+              std::fwrite(records.data(), sizeof(trace_record), records.size(),
+                          filep) == records.size());
+  return (std::fclose(filep) == 0) && ok;
+}
+
+/// dump_trace_at_exit arranges for dump_trace to write the trace into the
+/// file at @p path when the process exits normally.
+inline void dump_trace_at_exit(const char *path) {
+  trace_registry &registry = trace_registry::get();
+  std::unique_lock<std::mutex> _{registry.mutex};
+  if (registry.exit_path.empty()) {
+    std::atexit([]() {
+      trace_registry &reg = trace_registry::get();
+      std::string where;
+      {
+        std::unique_lock<std::mutex> lock{reg.mutex};
+        where = reg.exit_path;
+      }
+      (void)dump_trace(where.c_str());
+    });
+  }
+  registry.exit_path = path;
+}
+
+/// chrome_trace converts the binary trace written by dump_trace read from
+/// @p input into the Chrome trace event JSON format, which chrome://tracing
+/// and Perfetto can display, writing it to @p output. Hits are instant
+/// events and scopes are duration events, whose timestamps are relative to
+/// when tracing started. Records are streamed, so that the trace does not
+/// need to fit in memory. It returns whether it succeeded.
+inline bool chrome_trace(std::FILE *input, std::FILE *output) {
+  trace_header header{};
+  if (std::fread(&header, sizeof(header), 1, input) != 1 ||
+      std::memcmp(header.magic, "MKMOCKTR", sizeof(header.magic)) != 0 ||
+      header.version != 1 || header.ticks_per_second == 0) {
+    return false;
+  }
+  std::vector<std::string> names;
+  for (std::uint32_t i = 0; i < header.hooks; ++i) {
+    std::uint32_t length = 0;
+    if (std::fread(&length, sizeof(length), 1, input) != 1) {
+      return false;
+    }
+    std::string raw(length, '\0');
+    if (length > 0 && std::fread(&raw[0], 1, length, input) != length) {
+      return false;
+    }
+    std::string escaped;
+    for (char c : raw) {
+      if (c == '"' || c == '\\') {
+        escaped += '\\';
+        escaped += c;
+      } else if (static_cast<unsigned char>(c) < 0x20) {
+        char buf[8];
+        std::snprintf(buf, sizeof(buf), "\\u%04x", static_cast<unsigned>(c));
+        escaped += buf;
+      } else {
+        escaped += c;
+      }
+    }
+    names.push_back(std::move(escaped));
+  }
+  bool ok =
+      std::fputs("{\"displayTimeUnit\":\"ns\",\"traceEvents\":[", output) >= 0;
+  const char *separator = "\n";
+  std::vector<trace_record> chunk(4096);
+  for (std::uint64_t left = header.records; ok && left > 0;) {
+    std::size_t count = static_cast<std::size_t>(
+        (std::min)(left, static_cast<std::uint64_t>(chunk.size())));
+    if (std::fread(chunk.data(), sizeof(trace_record), count, input) != count) {
+      return false;
+    }
+    left -= count;
+    for (std::size_t i = 0; ok && i < count; ++i) {
+      const trace_record &record = chunk[i];
+      const char *name = (record.hook < names.size())
+                             ? names[record.hook].c_str() : "";
+      std::int64_t ticks =
+          static_cast<std::int64_t>(record.timestamp - header.start);
+      double micros = static_cast<double>(ticks) * 1e6 /
+                      static_cast<double>(header.ticks_per_second);
+      const char *format = nullptr;
+      switch (static_cast<trace_kind>(record.kind)) {
+        case trace_kind::hit:
+          format = "{\"name\":\"%s\",\"cat\":\"hit\",\"ph\":\"i\",\"s\":\"t\","
+                   "\"ts\":%.3f,\"pid\":1,\"tid\":%u}";
+          break;
+        case trace_kind::override:
+          format = "{\"name\":\"%s\",\"cat\":\"override\",\"ph\":\"i\","
+                   "\"s\":\"t\",\"ts\":%.3f,\"pid\":1,\"tid\":%u}";
+          break;
+        case trace_kind::scope_enter:
+          format = "{\"name\":\"%s\",\"cat\":\"scope\",\"ph\":\"B\","
+                   "\"ts\":%.3f,\"pid\":1,\"tid\":%u}";
+          break;
+        case trace_kind::scope_exit:
+          format = "{\"name\":\"%s\",\"cat\":\"scope\",\"ph\":\"E\","
+                   "\"ts\":%.3f,\"pid\":1,\"tid\":%u}";
+          break;
+      }
+      if (format == nullptr) {
+        continue;  // Skip records of unknown kinds
+      }
+      ok = std::fputs(separator, output) >= 0 &&
+           std::fprintf(output, format, name, micros,
+                        static_cast<unsigned>(record.thread)) > 0;
+      separator = ",\n";
+    }
+  }
+  return ok && std::fputs("\n]}\n", output) >= 0;
+}
+#endif  // MKMOCK_ENABLE_TRACE
+
+/// seed_random seeds the random number generators of all threads with
+/// @p seed. Each thread then draws from its own reproducible stream, which
+/// depends on @p seed and on the order in which threads first draw after
+/// seeding, provided that no thread draws while seeding.
+inline void seed_random(std::uint64_t seed) noexcept;
+
+/// thread_random is a counter based random number generator private to
+/// the calling thread, so that drawing numbers never contends.
+class thread_random {
+ public:
+  /// next returns the next 32 bit random number of the calling thread.
+  static std::uint32_t next() noexcept {
+    state &st = current();
+    unsigned generation = global().generation.load(std::memory_order_acquire);
+    if (st.generation != generation) {
+      st.ordinal = global().ordinals.fetch_add(1) + 1;
+      st.stream = mix(global().seed.load(std::memory_order_relaxed) ^
+                      (st.ordinal * golden_ratio));
+      st.counter = 0;
+      st.generation = generation;
+    }
+    return static_cast<std::uint32_t>(mix(st.stream + ++st.counter * golden_ratio) >> 32);
+  }
+
+ private:
+  friend void seed_random(std::uint64_t seed) noexcept;
+
+  struct shared {
+    std::atomic<std::uint64_t> seed{0};
+    std::atomic<unsigned> generation{1};
+    std::atomic<std::uint64_t> ordinals{0};
+  };
+
+  struct state {
+    unsigned generation;
+    std::uint64_t ordinal;
+    std::uint64_t stream;
+    std::uint64_t counter;
+  };
+
+  static constexpr std::uint64_t golden_ratio = 0x9e3779b97f4a7c15ULL;
+
+  // mix is the finalizer of splitmix64.
+  static std::uint64_t mix(std::uint64_t z) noexcept {
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+  }
+
+  static shared &global() noexcept {
+    static shared instance;
+    return instance;
+  }
+
+  static state &current() noexcept {
+    static thread_local state instance = {0, 0, 0, 0};
+    return instance;
+  }
+};
+
+inline void seed_random(std::uint64_t seed) noexcept {
+  thread_random::global().seed.store(seed, std::memory_order_relaxed);
+  thread_random::global().ordinals.store(0, std::memory_order_relaxed);
+  thread_random::global().generation.fetch_add(1, std::memory_order_release);
+}
+
+/// policy tells when an enabled hook overrides the variable at a site. The
+/// hits of the hook are numbered from zero while the hook is enabled and the
+/// hook overrides at hit `n` when the schedule allows it, i.e. if `n` is not
+/// less than @p skip and either `n - skip` is less than @p times or @p every
+/// is nonzero and `n - skip - times + 1` is a multiple of @p every, and then
+/// with probability @p probability.
+struct policy {
+  /// probability is the probability of overriding at each hit.
+  double probability = 1.0;
+
+  /// skip is the number of hits to let through at the beginning.
+  std::uint64_t skip = 0;
+
+  /// times is the number of consecutive hits to override after skipping.
+  std::uint64_t times = UINT64_MAX;
+
+  /// every, when nonzero, overrides every @p every hits afterwards.
+  std::uint64_t every = 0;
+};
+
+/// with_probability returns a policy overriding with probability @p p.
+inline policy with_probability(double p) noexcept {
+  policy result;
+  result.probability = p;
+  return result;
+}
+
+/// with_schedule returns a policy that lets the first @p skip hits through,
+/// then overrides @p times hits, then overrides every @p every hits.
+inline policy with_schedule(std::uint64_t skip, std::uint64_t times,
+                            std::uint64_t every = 0) noexcept {
+  policy result;
+  result.skip = skip;
+  result.times = times;
+  result.every = every;
+  return result;
+}
+
+#ifdef MKMOCK_ENABLE_CONFIG
+/// config_entry is the configuration of a hook: the text of its value and
+/// the policy it should follow.
+struct config_entry {
+  std::string value;
+  mkmock::policy policy;
+};
+
+/// parse_config parses the configuration @p text into @p entries, which
+/// are indexed by hook name, and returns false if some entry is invalid.
+/// Invalid entries are reported on the standard error and skipped. Entries
+/// are separated by semicolons or newlines, and look like:
+///
+/// ```
+/// # Fail one connect in a thousand, after the first ten.
+/// connect=-1,probability=0.001,skip=10
+/// read=-1,times=1,every=100
+/// ```
+///
+/// where the options are the fields of mkmock::policy. Empty entries and
+/// entries starting with `#` are ignored. Values cannot contain commas.
+inline bool parse_config(const std::string &text,
+                         std::map<std::string, config_entry> &entries) {
+  auto trim = [](const std::string &str) {
+    size_t begin = str.find_first_not_of(" \t\r");
+    size_t end = str.find_last_not_of(" \t\r");
+    return (begin == std::string::npos) ? std::string{}
+                                        : str.substr(begin, end - begin + 1);
+  };
+  auto number = [](const std::string &str, double &result) {
+    char *end = nullptr;
+    result = std::strtod(str.c_str(), &end);
+    return !str.empty() && *end == '\0';
+  };
+  auto count = [](const std::string &str, std::uint64_t &result) {
+    char *end = nullptr;
+    result = std::strtoull(str.c_str(), &end, 10);
+    return !str.empty() && str[0] != '-' && *end == '\0';
+  };
+  bool ok = true;
+  for (size_t begin = 0; begin <= text.size();) {
+    size_t end = text.find_first_of(";\n", begin);
+    if (end == std::string::npos) {
+      end = text.size();
+    }
+    std::string entry = trim(text.substr(begin, end - begin));
+    begin = end + 1;
+    if (entry.empty() || entry[0] == '#') {
+      continue;
+    }
+    std::vector<std::string> fields;
+    for (size_t first = 0; first <= entry.size();) {
+      size_t last = entry.find(',', first);
+      if (last == std::string::npos) {
+        last = entry.size();
+      }
+      fields.push_back(trim(entry.substr(first, last - first)));
+      first = last + 1;
+    }
+    config_entry result;
+    std::string name;
+    bool valid = true;
+    for (size_t i = 0; valid && i < fields.size(); ++i) {
+      size_t equal = fields[i].find('=');
+      if (equal == std::string::npos) {
+        valid = false;
+        break;
+      }
+      std::string key = trim(fields[i].substr(0, equal));
+      std::string value = trim(fields[i].substr(equal + 1));
+      if (i == 0) {
+        name = key;
+        result.value = value;
+        valid = !name.empty();
+      } else if (key == "probability") {
+        valid = number(value, result.policy.probability);
+      } else if (key == "skip") {
+        valid = count(value, result.policy.skip);
+      } else if (key == "times") {
+        valid = count(value, result.policy.times);
+      } else if (key == "every") {
+        valid = count(value, result.policy.every);
+      } else {
+        valid = false;
+      }
+    }
+    if (!valid) {
+      std::fprintf(stderr, "mkmock: invalid configuration entry: %s\n",
+                   entry.c_str());
+      ok = false;
+      continue;
+    }
+    entries[name] = std::move(result);
+  }
+  return ok;
+}
+
+/// find_config returns the configuration of the hook named @p name, or
+/// nullptr. The configuration is read from the MKMOCK_CONFIG environment
+/// variable when this function is first called. If the variable starts
+/// with `@`, the configuration is read from the file whose path follows.
+inline const config_entry *find_config(const char *name) {
+  static const std::map<std::string, config_entry> entries = []() {
+    std::map<std::string, config_entry> result;
+    const char *env = std::getenv("MKMOCK_CONFIG");
+    if (env == nullptr) {
+      return result;
+    }
+    std::string text = env;
+    if (!text.empty() && text[0] == '@') {
+      std::FILE *filep = std::fopen(text.c_str() + 1, "r");
+      if (filep == nullptr) {
+        std::perror(text.c_str() + 1);
+        return result;
+      }
+      text.clear();
+      char buf[4096];
+      size_t count = 0;
+      while ((count = std::fread(buf, 1, sizeof(buf), filep)) > 0) {
+        text.append(buf, count);
+      }
+      std::fclose(filep);
+    }
+    (void)parse_config(text, result);
+    return result;
+  }();
+  auto it = entries.find(name);
+  return (it != entries.end()) ? &it->second : nullptr;
+}
+
+/// config_value parses the text of the configured values of type @p Type.
+/// It supports arithmetic types, strings and null pointers, and can be
+/// specialized to support other types.
+template <typename Type, typename = void>
+struct config_value {
+  static constexpr bool supported = false;
+};
+
+template <typename Type>
+struct config_value<Type, typename std::enable_if<
+                              std::is_arithmetic<Type>::value>::type> {
+  static constexpr bool supported = true;
+
+  static bool parse(const std::string &text, Type &value) {
+    char *end = nullptr;
+    if (std::is_same<Type, bool>::value &&
+        (text == "true" || text == "false")) {
+      value = (text == "true");
+      return true;
+    }
+    if (std::is_floating_point<Type>::value) {
+      value = static_cast<Type>(std::strtold(text.c_str(), &end));
+    } else if (std::is_signed<Type>::value) {
+      value = static_cast<Type>(std::strtoll(text.c_str(), &end, 0));
+    } else {
+      value = static_cast<Type>(std::strtoull(text.c_str(), &end, 0));
+    }
+    return !text.empty() && *end == '\0';
+  }
+};
+
+template <typename Type>
+struct config_value<
+    Type, typename std::enable_if<std::is_pointer<Type>::value ||
+                                  std::is_same<Type, std::nullptr_t>::value>::type> {
+  static constexpr bool supported = true;
+
+  static bool parse(const std::string &text, Type &value) {
+    value = nullptr;
+    return text == "null" || text == "nullptr" || text == "0";
+  }
+};
+
+template <>
+struct config_value<std::string> {
+  static constexpr bool supported = true;
+
+  static bool parse(const std::string &text, std::string &value) {
+    value = text;
+    return true;
+  }
+};
+#endif  // MKMOCK_ENABLE_CONFIG
+
+/// sequence is a scripted sequence of values that an enabled hook consumes
+/// one per hit, in order. Each value is moved out of the sequence exactly
+/// once, so move only types are supported, and concurrent hits claim their
+/// value using an atomic counter. Once the sequence is exhausted, the hook
+/// stops overriding variables.
+template <typename Type>
+class sequence {
+ public:
+  /// sequence constructs a sequence containing @p values.
+  explicit sequence(std::vector<Type> values) noexcept
+      : values_{std::move(values)} {}
+
+  /// sequence constructs a sequence containing @p values.
+  sequence(std::initializer_list<Type> values) : values_{values} {}
+
+  sequence(sequence &&other) noexcept
+      : values_{std::move(other.values_)},
+        next_{other.next_.load(std::memory_order_relaxed)} {}
+
+  /// consume claims the next value and calls @p func with it. It returns
+  /// false without calling @p func if the sequence is exhausted.
+  template <typename Func>
+  bool consume(Func &&func) const {
+    size_t index = next_.fetch_add(1, std::memory_order_relaxed);
+    if (index >= values_.size()) {
+      return false;
+    }
+    std::forward<Func>(func)(std::move(values_[index]));
+    return true;
+  }
+
+ private:
+  mutable std::vector<Type> values_;
+  mutable std::atomic<size_t> next_{0};
+};
+
+#ifdef MKMOCK_HAVE_VALUE_LOG
+/// value_log is an append only log of the values seen by hook sites, kept
+/// in a memory mapped file. The file starts with a header, containing the
+/// "MKMOCKRR" magic, the version and the size of the entries. Each entry is
+/// the 64 bit key of the hook that appended it, the size of the value, a
+/// commit flag, and the value's bytes, padded to eight bytes. Integers are
+/// in the host byte order. Because values are raw bytes, a log can only be
+/// replayed on the same platform, and pointers are meaningless when they
+/// are replayed by another process.
+class value_log {
+ public:
+  /// entry is a value of the log.
+  struct entry {
+    const unsigned char *data;
+    std::uint32_t size;
+  };
+
+  /// create creates a log at @p path, truncating any existing file, that
+  /// may contain up to @p capacity bytes of entries. It returns a null
+  /// pointer on failure. Appends that do not fit are dropped.
+  static std::shared_ptr<value_log> create(const char *path,
+                                           std::uint64_t capacity) {
+    capacity = (capacity + 7) & ~std::uint64_t{7};
+    int fd = ::open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1) {
+      return nullptr;
+    }
+    std::shared_ptr<value_log> log{new value_log};
+    log->fd_ = fd;
+    log->size_ = sizeof(header) + capacity;
+    if (::ftruncate(fd, static_cast<off_t>(log->size_)) != 0 ||
+        !log->map(PROT_READ | PROT_WRITE)) {
+      return nullptr;
+    }
+    header *hdr = log->get_header();
+    std::memcpy(hdr->magic, "MKMOCKRR", sizeof(hdr->magic));
+    hdr->version = 1;
+    hdr->capacity = capacity;
+    return log;
+  }
+
+  /// open opens the log at @p path for replaying and indexes its entries
+  /// by hook, such that replaying does not need to parse the log. It
+  /// returns a null pointer on failure.
+  static std::shared_ptr<const value_log> open(const char *path) {
+    int fd = ::open(path, O_RDONLY);
+    if (fd == -1) {
+      return nullptr;
+    }
+    std::shared_ptr<value_log> log{new value_log};
+    log->fd_ = fd;
+    struct stat info;
+    if (::fstat(fd, &info) != 0 ||
+        static_cast<std::uint64_t>(info.st_size) < sizeof(header)) {
+      return nullptr;
+    }
+    log->size_ = static_cast<std::uint64_t>(info.st_size);
+    if (!log->map(PROT_READ)) {
+      return nullptr;
+    }
+    const header *hdr = log->get_header();
+    if (std::memcmp(hdr->magic, "MKMOCKRR", sizeof(hdr->magic)) != 0 ||
+        hdr->version != 1) {
+      return nullptr;
+    }
+    std::uint64_t end = (std::min)(hdr->size.load(std::memory_order_acquire),
+                                   log->size_ - sizeof(header));
+    for (std::uint64_t offset = 0; offset + sizeof(entry_header) <= end;) {
+      const entry_header *hdr_entry = log->get_entry(offset);
+      std::uint64_t total = sizeof(entry_header) + padded(hdr_entry->size);
+      if (hdr_entry->committed.load(std::memory_order_acquire) == 0 ||
+          offset + total > end) {
+        break;  // Appending this entry was interrupted
+      }
+      log->index_[hdr_entry->key].push_back(
+          entry{reinterpret_cast<const unsigned char *>(hdr_entry) +
+                    sizeof(entry_header),
+                hdr_entry->size});
+      offset += total;
+    }
+    return log;
+  }
+
+  /// key returns the key of the hook named @p name.
+  static std::uint64_t key(const char *name) noexcept {
+    std::uint64_t hash = 14695981039346656037ull;  // FNV-1a
+    for (; *name != '\0'; ++name) {
+      hash = (hash ^ static_cast<unsigned char>(*name)) * 1099511628211ull;
+    }
+    return hash;
+  }
+
+  /// append appends the @p size bytes at @p data for the hook whose key is
+  /// @p key and returns whether they fit. Threads may append concurrently.
+  bool append(std::uint64_t key, const void *data,
+              std::uint32_t size) const noexcept {
+    std::uint64_t total = sizeof(entry_header) + padded(size);
+    header *hdr = get_header();
+    std::uint64_t offset =
+        hdr->size.fetch_add(total, std::memory_order_relaxed);
+    if (offset + total > hdr->capacity) {
+      return false;
+    }
+    entry_header *hdr_entry = get_entry(offset);
+    hdr_entry->key = key;
+    hdr_entry->size = size;
+    std::memcpy(reinterpret_cast<unsigned char *>(hdr_entry) +
+                    sizeof(entry_header),
+                data, size);
+    hdr_entry->committed.store(1, std::memory_order_release);
+    return true;
+  }
+
+  /// entries returns the entries of the hook whose key is @p key, in the
+  /// order in which they have been appended, or nullptr.
+  const std::vector<entry> *entries(std::uint64_t key) const {
+    auto it = index_.find(key);
+    return (it != index_.end()) ? &it->second : nullptr;
+  }
+
+  /// ~value_log unmaps the log and, if it has been created, truncates
+  /// the file after the last entry.
+  ~value_log() {
+    if (base_ != nullptr) {
+      if (writable_) {
+        std::uint64_t used = (std::min)(get_header()->size.load(),
+                                        get_header()->capacity);
+        ::munmap(base_, static_cast<size_t>(size_));
+        (void)::ftruncate(fd_, static_cast<off_t>(sizeof(header) + used));
+      } else {
+        ::munmap(base_, static_cast<size_t>(size_));
+      }
+    }
+    if (fd_ != -1) {
+      ::close(fd_);
+    }
+  }
+
+  value_log(const value_log &) = delete;
+  value_log &operator=(const value_log &) = delete;
+
+ private:
+  struct header {
+    char magic[8];
+    std::uint32_t version;
+    std::uint32_t reserved;
+    std::uint64_t capacity;
+    std::atomic<std::uint64_t> size;
+  };
+
+  struct entry_header {
+    std::uint64_t key;
+    std::uint32_t size;
+    std::atomic<std::uint32_t> committed;
+  };
+
+  value_log() = default;
+
+  static std::uint64_t padded(std::uint64_t size) noexcept {
+    return (size + 7) & ~std::uint64_t{7};
+  }
+
+  bool map(int protection) {
+    void *base = ::mmap(nullptr, static_cast<size_t>(size_), protection,
+                        MAP_SHARED, fd_, 0);
+    if (base == MAP_FAILED) {
+      return false;
+    }
+    base_ = static_cast<unsigned char *>(base);
+    writable_ = (protection & PROT_WRITE) != 0;
+    return true;
+  }
+
+  header *get_header() const noexcept {
+    return reinterpret_cast<header *>(base_);
+  }
+
+  entry_header *get_entry(std::uint64_t offset) const noexcept {
+    return reinterpret_cast<entry_header *>(base_ + sizeof(header) + offset);
+  }
+
+  int fd_ = -1;
+  unsigned char *base_ = nullptr;
+  std::uint64_t size_ = 0;
+  bool writable_ = false;
+  std::map<std::uint64_t, std::vector<entry>> index_;
+};
+
+/// value_recording is where a hook being recorded appends its values.
+struct value_recording {
+  std::shared_ptr<value_log> log;
+  std::uint64_t key;
+};
+
+/// value_replay is the position of a hook being replayed in a value_log.
+/// Like a sequence, concurrent hits claim entries using an atomic counter.
+class value_replay {
+ public:
+  value_replay(std::shared_ptr<const value_log> log, std::uint64_t key)
+      : log_{std::move(log)}, entries_{log_->entries(key)} {}
+
+  /// consume claims the next entry and calls @p func with its value. It
+  /// returns false without calling @p func if the entries are exhausted
+  /// or if the entry's size is not the size of @p Type.
+  template <typename Type, typename Func>
+  bool consume(Func &&func) const {
+    static_assert(std::is_trivially_copyable<Type>::value,
+                  "mkmock: only trivially copyable values can be replayed");
+    size_t index = next_.fetch_add(1, std::memory_order_relaxed);
+    if (entries_ == nullptr || index >= entries_->size() ||
+        (*entries_)[index].size != sizeof(Type)) {
+      return false;
+    }
+    typename std::aligned_storage<sizeof(Type), alignof(Type)>::type storage;
+    std::memcpy(&storage, (*entries_)[index].data, sizeof(Type));
+    std::forward<Func>(func)(*reinterpret_cast<Type *>(&storage));
+    return true;
+  }
+
+ private:
+  std::shared_ptr<const value_log> log_;
+  const std::vector<value_log::entry> *entries_;
+  mutable std::atomic<size_t> next_{0};
+};
+#endif  // MKMOCK_HAVE_VALUE_LOG
+
+#ifdef MKMOCK_ENABLE_TIME
+/// saturating_add returns @p a + @p b, or the largest or smallest duration
+/// if the sum does not fit.
+template <typename Duration>
+Duration saturating_add(Duration a, Duration b) noexcept {
+  if (b.count() > 0 && a > (Duration::max)() - b) {
+    return (Duration::max)();
+  }
+  if (b.count() < 0 && a < (Duration::min)() - b) {
+    return (Duration::min)();
+  }
+  return a + b;
+}
+
+/// virtual_clock is a process wide clock that only moves when advanced,
+/// which allows reproducing delays deterministically and instantly, along
+/// with a queue of timers that fire, in order, as the clock is advanced.
+/// Code should read it through mkmock::clock, which uses the virtual clock
+/// only while MKMOCK_WITH_VIRTUAL_CLOCK is enabling it.
+class virtual_clock {
+ public:
+  /// timer_id identifies a timer.
+  using timer_id = std::uint64_t;
+
+  /// now returns the time elapsed since the clock epoch.
+  static std::chrono::nanoseconds now() noexcept {
+    return std::chrono::nanoseconds{ticks().load(std::memory_order_acquire)};
+  }
+
+  /// advance moves the clock forward by @p amount. The timers expiring
+  /// meanwhile fire in deadline order, then in scheduling order, with the
+  /// clock set to their deadline. They run in the calling thread and are
+  /// free to schedule further timers.
+  static void advance(std::chrono::nanoseconds amount) {
+    state &st = get();
+    std::int64_t remaining = amount.count();
+    for (;;) {
+      std::unique_lock<std::mutex> lock{st.mutex};
+      std::int64_t current = ticks().load(std::memory_order_relaxed);
+      std::int64_t target = saturating_add(std::chrono::nanoseconds{current},
+                                           std::chrono::nanoseconds{remaining})
+                                .count();
+      if (st.timers.empty() || st.timers.begin()->first.first > target) {
+        ticks().store(target, std::memory_order_release);
+        st.cond.notify_all();
+        return;
+      }
+      auto it = st.timers.begin();
+      std::int64_t deadline = (std::max)(it->first.first, current);
+      std::function<void()> callback = std::move(it->second);
+      st.deadlines.erase(it->first.second);
+      st.timers.erase(it);
+      remaining = target - deadline;
+      ticks().store(deadline, std::memory_order_release);
+      st.cond.notify_all();
+      lock.unlock();
+      callback();
+    }
+  }
+
+  /// advance_to_next moves the clock to the deadline of the next timer and
+  /// fires it. It returns false if there are no pending timers.
+  static bool advance_to_next() {
+    std::int64_t amount = 0;
+    {
+      state &st = get();
+      std::unique_lock<std::mutex> _{st.mutex};
+      if (st.timers.empty()) {
+        return false;
+      }
+      amount = (std::max)(st.timers.begin()->first.first - ticks().load(),
+                          std::int64_t{0});
+    }
+    advance(std::chrono::nanoseconds{amount});
+    return true;
+  }
+
+  /// schedule schedules @p callback to fire when the clock reaches @p
+  /// deadline and returns the timer's ID.
+  static timer_id schedule(std::chrono::nanoseconds deadline,
+                           std::function<void()> callback) {
+    state &st = get();
+    std::unique_lock<std::mutex> _{st.mutex};
+    timer_id id = ++st.next_id;
+    st.timers.emplace(std::make_pair(deadline.count(), id),
+                      std::move(callback));
+    st.deadlines.emplace(id, deadline.count());
+    return id;
+  }
+
+  /// schedule_after is like schedule with a deadline @p delay from now.
+  static timer_id schedule_after(std::chrono::nanoseconds delay,
+                                 std::function<void()> callback) {
+    return schedule(saturating_add(now(), delay), std::move(callback));
+  }
+
+  /// cancel cancels the timer @p id and returns whether it was pending.
+  static bool cancel(timer_id id) {
+    state &st = get();
+    std::unique_lock<std::mutex> _{st.mutex};
+    auto it = st.deadlines.find(id);
+    if (it == st.deadlines.end()) {
+      return false;
+    }
+    st.timers.erase(std::make_pair(it->second, id));
+    st.deadlines.erase(it);
+    return true;
+  }
+
+  /// pending returns the number of pending timers.
+  static size_t pending() {
+    state &st = get();
+    std::unique_lock<std::mutex> _{st.mutex};
+    return st.timers.size();
+  }
+
+  /// sleep_until blocks the calling thread until another thread advances
+  /// the clock to @p deadline.
+  static void sleep_until(std::chrono::nanoseconds deadline) {
+    state &st = get();
+    std::unique_lock<std::mutex> lock{st.mutex};
+    st.cond.wait(lock, [&]() { return ticks().load() >= deadline.count(); });
+  }
+
+ private:
+  struct state {
+    std::mutex mutex;
+    std::condition_variable cond;
+    std::map<std::pair<std::int64_t, timer_id>, std::function<void()>> timers;
+    std::map<timer_id, std::int64_t> deadlines;
+    timer_id next_id = 0;
+  };
+
+  static std::atomic<std::int64_t> &ticks() noexcept {
+    static std::atomic<std::int64_t> value{0};
+    return value;
+  }
+
+  static state &get() {
+    static state instance;
+    return instance;
+  }
+};
+
+/// delay is the value of a latency hook, i.e. of a hook reached using
+/// MKMOCK_DELAY_ENABLED. It describes how long to delay the calling thread,
+/// either a fixed amount or an amount sampled from a lognormal or a Pareto
+/// distribution using the thread's generator (see seed_random), and how,
+/// i.e. by sleeping, by busy spinning or by advancing the virtual_clock.
+struct delay {
+  enum class distribution { fixed, lognormal, pareto };
+  enum class backend { sleep, spin, virtual_clock };
+
+  distribution dist = distribution::fixed;
+  backend how = backend::sleep;
+
+  /// first is the fixed delay, in nanoseconds, the mean of the natural
+  /// logarithm of the delay in nanoseconds for lognormal delays, or the
+  /// minimum delay in nanoseconds for Pareto delays.
+  double first = 0.0;
+
+  /// second is the standard deviation of the natural logarithm of the
+  /// delay for lognormal delays or the shape for Pareto delays.
+  double second = 0.0;
+
+  /// using_backend returns a copy of this delay using @p with.
+  delay using_backend(backend with) const noexcept {
+    delay result = *this;
+    result.how = with;
+    return result;
+  }
+
+  /// sample returns how long to delay the calling thread.
+  std::chrono::nanoseconds sample() const noexcept {
+    double nanoseconds = first;
+    switch (dist) {
+      case distribution::fixed: break;
+      case distribution::lognormal: {
+        // Box-Muller transform of two uniform numbers in (0, 1]
+        double u1 = uniform(), u2 = uniform();
+        double z = std::sqrt(-2.0 * std::log(u1)) * std::cos(6.283185307179586 * u2);
+        nanoseconds = std::exp(first + second * z);
+        break;
+      }
+      case distribution::pareto:
+        nanoseconds = first / std::pow(uniform(), 1.0 / second);
+        break;
+    }
+    // 2^63 is the smallest double not fitting into std::int64_t
+    const double limit = 9223372036854775808.0;
+    if (!(nanoseconds > 0.0)) {
+      return std::chrono::nanoseconds{0};
+    }
+    return std::chrono::nanoseconds{(nanoseconds < limit)
+                                        ? static_cast<std::int64_t>(nanoseconds)
+                                        : INT64_MAX};
+  }
+
+  /// wait delays the calling thread.
+  void wait() const {
+    std::chrono::nanoseconds amount = sample();
+    switch (how) {
+      case backend::sleep:
+        std::this_thread::sleep_for(amount);
+        break;
+      case backend::spin: {
+        // Compare the elapsed time, since the deadline may not fit
+        auto start = std::chrono::steady_clock::now();
+        while (std::chrono::steady_clock::now() - start < amount) {
+          // Nothing
+        }
+        break;
+      }
+      case backend::virtual_clock:
+        mkmock::virtual_clock::advance(amount);
+        break;
+    }
+  }
+
+ private:
+  static double uniform() noexcept {
+    return (static_cast<double>(thread_random::next()) + 1.0) / 4294967296.0;
+  }
+};
+
+/// fixed_delay returns a delay of @p amount.
+inline delay fixed_delay(std::chrono::nanoseconds amount) noexcept {
+  delay result;
+  result.first = static_cast<double>(amount.count());
+  return result;
+}
+
+/// lognormal_delay returns a lognormal delay where @p mu and @p sigma are
+/// the mean and the standard deviation of the natural logarithm of the
+/// delay in nanoseconds.
+inline delay lognormal_delay(double mu, double sigma) noexcept {
+  delay result;
+  result.dist = delay::distribution::lognormal;
+  result.first = mu;
+  result.second = sigma;
+  return result;
+}
+
+/// pareto_delay returns a Pareto delay with minimum @p scale and @p shape.
+inline delay pareto_delay(std::chrono::nanoseconds scale, double shape) noexcept {
+  delay result;
+  result.dist = delay::distribution::pareto;
+  result.first = static_cast<double>(scale.count());
+  result.second = shape;
+  return result;
+}
+#endif  // MKMOCK_ENABLE_TIME
+
+/// hook_base is the part of the hot state of a hook that does not depend
+/// on the type of the hook's value. The enabled field counts the scopes that
+/// are currently enabling the hook, either globally or for some thread.
+class hook_base {
+ public:
+#ifdef MKMOCK_ENABLE_CONFIG
+  // Hooks start armed, so that their first hit consults the configuration.
+  std::atomic<unsigned> enabled{1};
+#else
+  std::atomic<unsigned> enabled{0};
+#endif
+
+  /// apply makes the hook follow @p policy. The caller must hold the
+  /// hook's mutex.
+  void apply(const policy &policy) noexcept {
+    std::uint64_t threshold = always;
+    if (!(policy.probability >= 1.0)) {
+      threshold = (policy.probability > 0.0)
+                      ? static_cast<std::uint64_t>(policy.probability * always)
+                      : 0;
+    }
+    threshold_.store(threshold, std::memory_order_release);
+    skip_.store(policy.skip, std::memory_order_relaxed);
+    times_.store(policy.times, std::memory_order_relaxed);
+    every_.store(policy.every, std::memory_order_relaxed);
+    hits_.store(0, std::memory_order_relaxed);
+    scheduled_.store(policy.skip != 0 || policy.times != UINT64_MAX ||
+                         policy.every != 0,
+                     std::memory_order_release);
+  }
+
+  /// fires returns whether the policy allows overriding at this hit.
+  bool fires() const noexcept {
+    if (scheduled_.load(std::memory_order_acquire) &&
+        !scheduled(hits_.fetch_add(1, std::memory_order_relaxed))) {
+      return false;
+    }
+    std::uint64_t threshold = threshold_.load(std::memory_order_acquire);
+    return threshold >= always || thread_random::next() < threshold;
+  }
+
+  /// id returns the dense integer ID of the hook, which is assigned when
+  /// this function is first called for the hook, starting from zero, and
+  /// associated with @p name.
+  unsigned id(const char *name) const {
+    unsigned current = id_.load(std::memory_order_acquire);
+    if (current == 0) {
+      hook_ids &ids = hook_ids::get();
+      std::unique_lock<std::mutex> _{ids.mutex};
+      current = id_.load(std::memory_order_relaxed);
+      if (current == 0) {
+        current = ++ids.count;
+        ids.names.push_back(name);
+        id_.store(current, std::memory_order_release);
+      }
+    }
+    return current - 1;
+  }
+
+ private:
+  bool scheduled(std::uint64_t hit) const noexcept {
+    std::uint64_t skip = skip_.load(std::memory_order_relaxed);
+    if (hit < skip) {
+      return false;
+    }
+    hit -= skip;
+    std::uint64_t times = times_.load(std::memory_order_relaxed);
+    if (hit < times) {
+      return true;
+    }
+    std::uint64_t every = every_.load(std::memory_order_relaxed);
+    return every != 0 && (hit - times + 1) % every == 0;
+  }
+
+#ifdef MKMOCK_ENABLE_CONFIG
+ protected:
+  mutable std::atomic<bool> config_pending_{true};
+
+ private:
+#endif
+  static constexpr std::uint64_t always = std::uint64_t{1} << 32;
+  mutable std::atomic<unsigned> id_{0};
+  std::atomic<bool> scheduled_{false};
+  std::atomic<std::uint64_t> threshold_{always};
+  mutable std::atomic<std::uint64_t> hits_{0};
+  std::atomic<std::uint64_t> skip_{0};
+  std::atomic<std::uint64_t> times_{UINT64_MAX};
+  std::atomic<std::uint64_t> every_{0};
+};
+
+/// hook_descriptor describes a hook defined using MKMOCK_DEFINE_HOOK.
+struct hook_descriptor {
+  const char *name;   ///< The hook's tag.
+  std::size_t size;   ///< The size of the hook's type.
+  const char *file;   ///< Where the hook has been defined.
+  unsigned line;      ///< Where the hook has been defined.
+  hook_base *hook;    ///< The hook's state.
+
+  /// control, if not null, publishes the @p size bytes at @p value as the
+  /// hook's value if @p value is not null and restores the hook otherwise,
+  /// arming or disarming it if @p toggle is true. It is null for hooks whose
+  /// values are not trivially copyable.
+  void (*control)(const void *value, bool toggle);
+};
+
+#ifdef MKMOCK_HAVE_HOOK_REGISTRY
+/// hook_registration is what MKMOCK_DEFINE_HOOK emits into the mkmock_hooks
+/// section: the descriptor of a hook that is compiled in, or an empty slot,
+/// i.e. a null pointer, for a hook that is not. Since descriptors start with
+/// the non null name of their hook, for_each_descriptor tells them apart.
+template <bool CompiledIn>
+struct hook_registration {
+  hook_descriptor descriptor;
+};
+
+template <>
+struct alignas(void *) hook_registration<false> {};
+
+/// describe_hook returns the registration of the hook @p Hook, which only
+/// refers to the hook's state if the hook is compiled in, such that hooks
+/// that are not compiled in do not emit their state.
+template <typename Hook>
+constexpr hook_registration<true> describe_hook(const char *name,
+                                                std::size_t size,
+                                                const char *file,
+                                                unsigned line, std::true_type) {
+  return hook_registration<true>{{name, size, file, line,
+                                  &static_instance<Hook>::value,
+                                  Hook::controller()}};
+}
+
+template <typename Hook>
+constexpr hook_registration<false> describe_hook(const char *, std::size_t,
+                                                 const char *, unsigned,
+                                                 std::false_type) {
+  return hook_registration<false>{};
+}
+#endif
+
+}  // namespace mkmock
+
+#ifdef MKMOCK_HAVE_HOOK_REGISTRY
+extern "C" {
+extern mkmock::hook_descriptor __start_mkmock_hooks[]
+    __attribute__((weak, visibility("hidden")));
+extern mkmock::hook_descriptor __stop_mkmock_hooks[]
+    __attribute__((weak, visibility("hidden")));
+}
+#endif
+
+namespace mkmock {
+
+#ifdef MKMOCK_HAVE_HOOK_REGISTRY
+/// for_each_descriptor calls @p func with each descriptor in the
+/// mkmock_hooks section, skipping the slots of the hooks that are not
+/// compiled in, until @p func returns true.
+template <typename Func>
+void for_each_descriptor(Func &&func) {
+  const char *pos = reinterpret_cast<const char *>(__start_mkmock_hooks);
+  const char *end = reinterpret_cast<const char *>(__stop_mkmock_hooks);
+  while (pos != nullptr && pos < end) {
+    const void *first = nullptr;
+    std::memcpy(&first, pos, sizeof(first));
+    if (first == nullptr) {
+      pos += sizeof(hook_registration<false>);
+      continue;
+    }
+    if (func(reinterpret_cast<const hook_descriptor *>(pos))) {
+      return;
+    }
+    pos += sizeof(hook_registration<true>);
+  }
+}
+#endif
+
+/// registered_hooks returns the descriptors of the hooks defined by the
+/// executable or shared object calling it, read from the mkmock_hooks
+/// section. A hook defined in several translation units is returned once.
+/// The result is empty on platforms without ELF sections.
+inline std::vector<const hook_descriptor *> registered_hooks() {
+  std::vector<const hook_descriptor *> result;
+#ifdef MKMOCK_HAVE_HOOK_REGISTRY
+  for_each_descriptor([&](const hook_descriptor *desc) {
+    bool seen = false;
+    for (const hook_descriptor *other : result) {
+      seen = seen || other->hook == desc->hook;
+    }
+    if (!seen) {
+      result.push_back(desc);
+    }
+    return false;
+  });
+#endif
+  return result;
+}
+
+/// find_hook returns the descriptor of the hook named @p name, or nullptr.
+inline const hook_descriptor *find_hook(const char *name) {
+  const hook_descriptor *found = nullptr;
+#ifdef MKMOCK_HAVE_HOOK_REGISTRY
+  for_each_descriptor([&](const hook_descriptor *desc) {
+    if (std::strcmp(desc->name, name) == 0) {
+      found = desc;
+    }
+    return found != nullptr;
+  });
+#else
+  (void)name;
+#endif
+  return found;
+}
+
+/// hook_value is the globally visible value of a hook of type @p Type.
+/// Values that are not trivially copyable are published as immutable
+/// snapshots, while the others are published using a seqlock.
+template <typename Type, bool = std::is_trivially_copyable<Type>::value &&
+                                    std::is_default_constructible<Type>::value>
+class hook_value {
+ public:
+  /// visit calls @p func with a copy of the value if it is published.
+  template <typename Func>
+  bool visit(Func &&func) const {
+    value_slot<Type> slot;
+    published_.visit([&](const Type &value) { slot.emplace(value); });
+    if (!slot.full()) {
+      return false;
+    }
+    std::forward<Func>(func)(std::move(slot.get()));
+    return true;
+  }
+
+  /// mock publishes @p mocked. The caller must hold the hook's mutex.
+  void mock(const Type &mocked) {
+    published_.publish(std::unique_ptr<const Type>(new Type(mocked)));
+  }
+
+  /// mock publishes @p mocked, moving rather than copying it.
+  void mock(Type &&mocked) {
+    published_.publish(std::unique_ptr<const Type>(new Type(std::move(mocked))));
+  }
+
+  /// restore stops publishing the value. The caller must hold the
+  /// hook's mutex.
+  void restore() { published_.publish(nullptr); }
+
+ private:
+  snapshot<Type> published_;
+};
+
+/// hook_value specialization for trivially copyable types.
+template <typename Type>
+class hook_value<Type, true> {
+ public:
+  template <typename Func>
+  bool visit(Func &&func) const {
+    return published_.visit(std::forward<Func>(func));
+  }
+
+  void mock(const Type &mocked) { published_.publish(mocked); }
+
+  void restore() { published_.retract(); }
+
+ private:
+  seqlock<Type> published_;
+};
+
+/// basic_hook is the state of the hook @p Derived with value of type @p
+/// Type. Besides the globally visible value, each thread may override the
+/// value using a stack of thread scopes, which take precedence.
+///
+/// The hot state, i.e. the enabled counter, the ID and the published value,
+/// comes first and the cold state used by writers comes last, on its own
+/// cache line. Since hooks are also cache line aligned, hook sites reading
+/// a hook never share cache lines with writers or with other hooks.
+template <typename Derived, typename Type>
+class alignas(MKMOCK_CACHE_LINE) basic_hook : public hook_base,
+                                              public hook_value<Type> {
+ public:
+  using value_type = Type;
+
+  /// handle is a value that can be shared with another thread.
+  using handle = std::shared_ptr<const Type>;
+
+  /// singleton returns the constant initialized instance of the hook.
+  static Derived *singleton() noexcept {
+    return &static_instance<Derived>::value;
+  }
+
+  /// saved_exception returns where MKMOCK_WITH_ENABLED_HOOK saves the
+  /// exception thrown by its code snippet. The caller must hold the
+  /// hook's mutex. This is not a data member because std::exception_ptr
+  /// cannot be constant initialized.
+  static std::exception_ptr &saved_exception() {
+    static std::exception_ptr exc;
+    return exc;
+  }
+
+#ifdef MKMOCK_HAVE_STATIC_KEYS
+  /// armed returns whether some scope is enabling the hook.
+  MKMOCK_ALWAYS_INLINE static bool armed() noexcept {
+    asm goto(MKMOCK_JUMP_SITE : : "i"(&key) : : l_armed);
+    return false;
+  l_armed:
+    return true;
+  }
+
+  /// arm increments the number of scopes enabling the hook.
+  void arm() {
+    enabled.fetch_add(1, std::memory_order_release);
+    update_jump_sites(&key, enabled);
+  }
+
+  /// disarm decrements the number of scopes enabling the hook.
+  void disarm() {
+    enabled.fetch_sub(1, std::memory_order_relaxed);
+    update_jump_sites(&key, enabled);
+  }
+#else
+  static bool armed() noexcept {
+    return Derived::singleton()->enabled.load(std::memory_order_acquire) != 0;
+  }
+
+  void arm() { enabled.fetch_add(1, std::memory_order_release); }
+
+  void disarm() { enabled.fetch_sub(1, std::memory_order_relaxed); }
+#endif
+
+  /// name returns the name of the hook, which MKMOCK_DEFINE_HOOK sets to
+  /// the hook's tag.
+  static const char *name() noexcept { return ""; }
+
+  /// id returns the dense integer ID of the hook.
+  unsigned id() const { return hook_base::id(Derived::name()); }
+
+  /// controller returns the function that hook_descriptor::control should
+  /// point to, which is null unless the values are trivially copyable.
+  static constexpr void (*controller())(const void *, bool) {
+    return controllable::value ? static_cast<void (*)(const void *, bool)>(
+                                     &basic_hook::control)
+                               : nullptr;
+  }
+
+  /// reached is called by hook sites and returns whether the hook may be
+  /// enabled, counting the hit when MKMOCK_ENABLE_COUNTERS is defined and
+  /// tracing it, unless visit will, when MKMOCK_ENABLE_TRACE is defined.
+  MKMOCK_ALWAYS_INLINE static bool reached() {
+#ifdef MKMOCK_ENABLE_COUNTERS
+    thread_counters::increment(&counter_slab::hits, Derived::singleton()->id());
+#endif
+#ifdef MKMOCK_ENABLE_TRACE
+    if (!armed()) {
+      thread_trace::append<Derived>(trace_kind::hit);
+      return false;
+    }
+    return true;
+#else
+    return armed();
+#endif
+  }
+
+  /// trace_scope traces entering, if @p entering is true, or leaving a
+  /// scope enabling the hook when MKMOCK_ENABLE_TRACE is defined.
+  static void trace_scope(bool entering) {
+#ifdef MKMOCK_ENABLE_TRACE
+    thread_trace::append<Derived>(entering ? trace_kind::scope_enter
+                                           : trace_kind::scope_exit);
+#else
+    (void)entering;
+#endif
+  }
+
+  /// slow_path is called by the sites of the hook when reached returns true
+  /// to record @p variable, if the hook is being recorded, and to override
+  /// it, if the hook has a value. It is shared by the sites whose variables
+  /// have the same type, and kept out of line, so that sites only inline
+  /// the check of reached.
+  template <typename Variable>
+  MKMOCK_COLD static void slow_path(Variable &variable) {
+    Derived *self = Derived::singleton();
+    self->observe(variable);
+    self->visit([&](Type value) { variable = std::move(value); });
+  }
+
+  /// slow_path_alloc is like slow_path except that it calls @p deleter
+  /// with @p variable, if not null, before overriding it.
+  template <typename Variable, typename Deleter>
+  MKMOCK_COLD static void slow_path_alloc(Variable &variable,
+                                          const Deleter &deleter) {
+    Derived *self = Derived::singleton();
+    self->observe(variable);
+    self->visit([&](Type value) {
+      if (variable != nullptr) {
+        deleter(variable);
+      }
+      variable = std::move(value);
+    });
+  }
+
+#ifdef MKMOCK_ENABLE_TIME
+  /// slow_path_delay is the slow_path of latency hooks.
+  MKMOCK_COLD static void slow_path_delay() {
+    Derived::singleton()->visit([](delay value) { value.wait(); });
+  }
+#endif
+
+#ifdef MKMOCK_ENABLE_COUNTERS
+  /// counters returns the counters of the hook aggregated across threads.
+  static hook_counters counters() {
+    return read_counters(Derived::singleton()->id());
+  }
+#endif
+
+  /// visit calls @p func with the value of the innermost thread scope,
+  /// if any, or with the globally visible value, if any.
+  template <typename Func>
+  bool visit(Func &&func) const {
+#ifdef MKMOCK_ENABLE_CONFIG
+    if (config_pending_.load(std::memory_order_acquire)) {
+      consult_config();
+    }
+#endif
+    bool overridden = visit(func, std::is_copy_constructible<Type>{});
+#ifdef MKMOCK_ENABLE_COUNTERS
+    if (overridden) {
+      thread_counters::increment(&counter_slab::overrides, id());
+    }
+#endif
+#ifdef MKMOCK_ENABLE_TRACE
+    thread_trace::append<Derived>(overridden ? trace_kind::override
+                                             : trace_kind::hit);
+#endif
+    return overridden;
+  }
+
+  using hook_value<Type>::mock;
+
+  /// mock publishes @p mocked, moving rather than copying it. Values of
+  /// move only types can be moved out of the hook only once, hence they
+  /// are one-shot: the first hit that fires takes the value and later hits
+  /// do not override their variables. The caller must hold the hook's mutex.
+  void mock(Type &&mocked) {
+    mock_value(std::move(mocked), std::is_copy_constructible<Type>{});
+  }
+
+  /// mock publishes the values of @p mocked, to be consumed one per hit.
+  /// The caller must hold the hook's mutex.
+  void mock(sequence<Type> mocked) {
+    sequence_.publish(std::unique_ptr<const sequence<Type>>(
+        new sequence<Type>(std::move(mocked))));
+  }
+
+  /// restore stops publishing both the value and the sequence. The caller
+  /// must hold the hook's mutex.
+  void restore() {
+    hook_value<Type>::restore();
+    sequence_.publish(nullptr);
+  }
+
+  /// load_config configures the hook from MKMOCK_CONFIG, if it has not been
+  /// configured yet, such that a scope enabling the hook afterwards
+  /// overrides the configuration rather than being overridden by it. It
+  /// does nothing unless MKMOCK_ENABLE_CONFIG is defined. The caller must
+  /// hold the hook's mutex.
+  void load_config() {
+#ifdef MKMOCK_ENABLE_CONFIG
+    if (config_pending_.load(std::memory_order_acquire)) {
+      consult_config();
+    }
+#endif
+  }
+
+  /// reset stops publishing both the value and the sequence and restores
+  /// the default policy or, if MKMOCK_CONFIG configured the hook, the
+  /// configured value and policy, whose schedule starts over. Scopes thus
+  /// override the configuration only temporarily. The caller must hold the
+  /// hook's mutex.
+  void reset() {
+    restore();
+    apply(policy{});
+#ifdef MKMOCK_ENABLE_CONFIG
+    if (configured_ != nullptr) {
+      using supported =
+          std::integral_constant<bool, config_value<Type>::supported>;
+      configure(*configured_, supported{});
+    }
+#endif
+  }
+
+  /// observe appends @p seen to the value_log the hook is being recorded
+  /// into, if any, provided that it is a trivially copyable @p Type.
+  template <typename Seen>
+  void observe(const Seen &seen) const {
+#ifdef MKMOCK_HAVE_VALUE_LOG
+    using recordable =
+        std::integral_constant<bool,
+                               std::is_trivially_copyable<Type>::value &&
+                                   std::is_convertible<const Seen &, Type>::value>;
+    observe(seen, recordable{});
+#else
+    (void)seen;
+#endif
+  }
+
+#ifdef MKMOCK_HAVE_VALUE_LOG
+  /// record starts appending the values seen by the hook's sites to @p
+  /// log, if not null, or stops appending them. The caller must hold the
+  /// hook's mutex.
+  void record(std::shared_ptr<value_log> log) {
+    std::unique_ptr<const value_recording> where;
+    if (log != nullptr) {
+      where.reset(new value_recording{std::move(log),
+                                      value_log::key(Derived::name())});
+    }
+    recording_.publish(std::move(where));
+  }
+
+  /// replay starts overriding variables with the values recorded for the
+  /// hook into @p log, if not null, or stops doing that. The caller must
+  /// hold the hook's mutex.
+  void replay(std::shared_ptr<const value_log> log) {
+    std::unique_ptr<const value_replay> position;
+    if (log != nullptr) {
+      position.reset(
+          new value_replay(std::move(log), value_log::key(Derived::name())));
+    }
+    replay_.publish(std::move(position));
+  }
+#endif
+
+  /// make_handle returns a handle wrapping @p mocked.
+  static handle make_handle(const Type &mocked) {
+    return std::make_shared<const Type>(mocked);
+  }
+
+  /// thread_handle returns the handle of the innermost thread scope of the
+  /// calling thread, or a null handle if there is no such scope.
+  static handle thread_handle() {
+    thread_scope *scope = thread_override();
+    return (scope != nullptr) ? scope->value : nullptr;
+  }
+
+  /// push_thread_scope enters a thread scope where the hook's value for the
+  /// calling thread is the value of @p mocked. A null @p mocked, e.g. the
+  /// handle of a thread that has no thread scope, does not override the
+  /// value, which the hook takes from the enclosing scopes instead.
+  void push_thread_scope(handle mocked) {
+    thread_top() = new thread_scope{std::move(mocked), thread_top(), {}};
+    if (thread_top()->value != nullptr) {
+      arm();
+      trace_scope(true);
+    }
+  }
+
+  /// save_thread_exception saves the exception currently being handled
+  /// such that pop_thread_scope can rethrow it.
+  static void save_thread_exception() {
+    thread_top()->saved_exc = std::current_exception();
+  }
+
+  /// pop_thread_scope leaves the innermost thread scope of the calling
+  /// thread and rethrows the exception it saved, if any.
+  void pop_thread_scope() {
+    std::unique_ptr<thread_scope> scope{thread_top()};
+    thread_top() = scope->previous;
+    if (scope->value != nullptr) {
+      trace_scope(false);
+      disarm();
+    }
+    if (scope->saved_exc) {
+      std::rethrow_exception(scope->saved_exc);
+    }
+  }
+
+ private:
+  template <typename Func>
+  bool visit(Func &func, std::true_type) const {
+    thread_scope *scope = thread_override();
+    if (scope != nullptr) {
+      func(*scope->value);
+      return true;
+    }
+    return fires() && (visit_sequence(func) || visit_replay(func) ||
+                       hook_value<Type>::visit(func));
+  }
+
+  // Move only values are always mocked using sequences, so each of them is
+  // moved out of the hook exactly once.
+  template <typename Func>
+  bool visit(Func &func, std::false_type) const {
+    return fires() && visit_sequence(func);
+  }
+
+  // The value is moved out of the sequence before calling func, which may
+  // block, e.g. to wait a delay, while the sequence's writer waits for it.
+  template <typename Func>
+  bool visit_sequence(Func &func) const {
+    value_slot<Type> slot;
+    sequence_.visit([&](const sequence<Type> &mocked) {
+      mocked.consume([&](Type &&value) { slot.emplace(std::move(value)); });
+    });
+    if (!slot.full()) {
+      return false;
+    }
+    func(std::move(slot.get()));
+    return true;
+  }
+
+  using controllable =
+      std::integral_constant<bool, std::is_trivially_copyable<Type>::value &&
+                                       std::is_default_constructible<Type>::value>;
+
+  static void control(const void *value, bool toggle) {
+    control(value, toggle, controllable{});
+  }
+
+  // Like scopes, the control plane overrides the value and the policy set
+  // by MKMOCK_CONFIG, if any, until it disables the hook.
+  static void control(const void *value, bool toggle, std::true_type) {
+    Derived *self = Derived::singleton();
+    std::unique_lock<recursive_mutex> _{self->mutex};
+    self->load_config();
+    if (value != nullptr) {
+      Type mocked;
+      std::memcpy(&mocked, value, sizeof(mocked));
+      if (toggle) {
+        self->apply(policy{});
+        self->arm();
+      }
+      self->mock(mocked);
+    } else {
+      if (toggle) {
+        self->disarm();
+      }
+      self->reset();
+    }
+  }
+
+  static void control(const void *, bool, std::false_type) {}
+
+  void mock_value(Type &&mocked, std::true_type) {
+    hook_value<Type>::mock(std::move(mocked));
+  }
+
+  void mock_value(Type &&mocked, std::false_type) {
+    std::vector<Type> values;
+    values.push_back(std::move(mocked));
+    mock(sequence<Type>(std::move(values)));
+  }
+
+#ifdef MKMOCK_ENABLE_CONFIG
+  // Called at the first hit of the hook, which started armed, to configure
+  // it from MKMOCK_CONFIG and disarm it if it is not configured. It does not
+  // wait for another thread holding the hook's mutex, but rather retries at
+  // the next hit, because such thread may be waiting for this one.
+  void consult_config() const {
+    basic_hook *self = const_cast<basic_hook *>(this);
+    if (!self->mutex.try_lock()) {
+      return;
+    }
+    if (config_pending_.load(std::memory_order_relaxed)) {
+      config_pending_.store(false, std::memory_order_release);
+      using supported =
+          std::integral_constant<bool, config_value<Type>::supported>;
+      const config_entry *entry = find_config(Derived::name());
+      if (entry != nullptr && self->configure(*entry, supported{})) {
+        self->configured_ = entry;
+      } else {
+        self->disarm();
+      }
+    }
+    self->mutex.unlock();
+  }
+
+  bool configure(const config_entry &entry, std::true_type) {
+    Type value;
+    if (!config_value<Type>::parse(entry.value, value)) {
+      std::fprintf(stderr, "mkmock: invalid value for hook %s: %s\n",
+                   Derived::name(), entry.value.c_str());
+      return false;
+    }
+    apply(entry.policy);
+    this->mock(value);
+    return true;
+  }
+
+  bool configure(const config_entry &, std::false_type) {
+    std::fprintf(stderr, "mkmock: hook %s cannot be configured\n",
+                 Derived::name());
+    return false;
+  }
+
+  const config_entry *configured_ = nullptr;
+#endif
+
+  template <typename Func>
+  bool visit_replay(Func &func) const {
+#ifdef MKMOCK_HAVE_VALUE_LOG
+    return visit_replay(func, std::is_trivially_copyable<Type>{});
+#else
+    (void)func;
+    return false;
+#endif
+  }
+
+#ifdef MKMOCK_HAVE_VALUE_LOG
+  // Only trivially copyable values are recorded, hence replayed.
+  template <typename Func>
+  bool visit_replay(Func &func, std::true_type) const {
+    value_slot<Type> slot;
+    replay_.visit([&](const value_replay &position) {
+      position.template consume<Type>(
+          [&](const Type &value) { slot.emplace(value); });
+    });
+    if (!slot.full()) {
+      return false;
+    }
+    func(slot.get());
+    return true;
+  }
+
+  template <typename Func>
+  bool visit_replay(Func &, std::false_type) const {
+    return false;
+  }
+
+  template <typename Seen>
+  void observe(const Seen &seen, std::true_type) const {
+    recording_.visit([&](const value_recording &where) {
+      const Type value = seen;
+      where.log->append(where.key, &value, sizeof(value));
+    });
+  }
+
+  template <typename Seen>
+  void observe(const Seen &, std::false_type) const {}
+
+  snapshot<value_recording> recording_;
+  snapshot<value_replay> replay_;
+#endif
+
+  snapshot<sequence<Type>> sequence_;
+
+  struct thread_scope {
+    handle value;
+    thread_scope *previous;
+    std::exception_ptr saved_exc;
+  };
+
+  static thread_scope *&thread_top() noexcept {
+    static thread_local thread_scope *top = nullptr;
+    return top;
+  }
+
+  // Returns the innermost thread scope overriding the value, if any.
+  static thread_scope *thread_override() noexcept {
+    thread_scope *scope = thread_top();
+    while (scope != nullptr && scope->value == nullptr) {
+      scope = scope->previous;
+    }
+    return scope;
+  }
+
+#ifdef MKMOCK_HAVE_STATIC_KEYS
+  static char key;
+#endif
+
+ public:
+  alignas(MKMOCK_CACHE_LINE) recursive_mutex mutex;
+};
+
+#ifdef MKMOCK_HAVE_STATIC_KEYS
+template <typename Derived, typename Type>
+char basic_hook<Derived, Type>::key;
+#endif
+
+/// hook_compiled_in tells whether mkmock::hook compiles in the hook @p
+/// Hook. Use MKMOCK_COMPILE_HOOK to specialize it, e.g. to keep a few
+/// production hooks compiled in when MKMOCK_HOOKS_COMPILED_IN is zero.
+template <typename Hook>
+struct hook_compiled_in
+    : std::integral_constant<bool, MKMOCK_HOOKS_COMPILED_IN != 0> {};
+
+/// enabled_scope enables the hook @p Hook with a mocked value for its
+/// lifetime. The caller must hold the hook's mutex.
+template <typename Hook>
+class enabled_scope {
+ public:
+  template <typename Mocked>
+  explicit enabled_scope(Mocked &&mocked, const policy &policy = {}) {
+    Hook::singleton()->load_config();
+    Hook::singleton()->apply(policy);
+    Hook::singleton()->mock(std::forward<Mocked>(mocked));
+    Hook::singleton()->arm();
+    Hook::singleton()->trace_scope(true);
+  }
+
+  ~enabled_scope() {
+    Hook::singleton()->trace_scope(false);
+    Hook::singleton()->disarm();
+    Hook::singleton()->reset();
+  }
+
+  enabled_scope(const enabled_scope &) = delete;
+  enabled_scope &operator=(const enabled_scope &) = delete;
+};
+
+/// thread_enabled_scope enables the hook @p Hook for the calling thread only
+/// for its lifetime.
+template <typename Hook>
+class thread_enabled_scope {
+ public:
+  explicit thread_enabled_scope(typename Hook::handle mocked) {
+    Hook::singleton()->push_thread_scope(std::move(mocked));
+  }
+
+  ~thread_enabled_scope() { Hook::singleton()->pop_thread_scope(); }
+
+  thread_enabled_scope(const thread_enabled_scope &) = delete;
+  thread_enabled_scope &operator=(const thread_enabled_scope &) = delete;
+};
+
+template <typename Hook, typename Variable>
+void hook(Variable &variable, std::true_type) {
+  if (MKMOCK_UNLIKELY(Hook::reached())) {
+    Hook::slow_path(variable);
+  }
+}
+
+template <typename Hook, typename Variable>
+void hook(Variable &, std::false_type) {}
+
+/// hook is the template alternative to MKMOCK_HOOK_ENABLED for the hook @p
+/// Hook, defined using MKMOCK_DEFINE_HOOK, and @p variable. It compiles to
+/// nothing when hook_compiled_in<Hook> is false.
+template <typename Hook, typename Variable>
+void hook(Variable &variable) {
+  hook<Hook>(variable, hook_compiled_in<Hook>{});
+}
+
+template <typename Hook, typename Variable, typename Deleter>
+void hook_alloc(Variable &variable, Deleter &&deleter, std::true_type) {
+  if (MKMOCK_UNLIKELY(Hook::reached())) {
+    Hook::singleton()->observe(variable);
+    Hook::singleton()->visit([&](typename Hook::value_type value) {
+      if (variable != nullptr) {
+        deleter(variable);
+      }
+      variable = std::move(value);
+    });
+  }
+}
+
+template <typename Hook, typename Variable, typename Deleter>
+void hook_alloc(Variable &, Deleter &&, std::false_type) {}
+
+/// hook_alloc is the template alternative to MKMOCK_HOOK_ALLOC_ENABLED.
+template <typename Hook, typename Variable, typename Deleter>
+void hook_alloc(Variable &variable, Deleter &&deleter) {
+  hook_alloc<Hook>(variable, std::forward<Deleter>(deleter),
+                   hook_compiled_in<Hook>{});
+}
+
+#ifdef MKMOCK_ENABLE_TIME
+template <typename Hook>
+void hook_delay(std::true_type) {
+  if (MKMOCK_UNLIKELY(Hook::reached())) {
+    Hook::slow_path_delay();
+  }
+}
+
+template <typename Hook>
+void hook_delay(std::false_type) {}
+
+/// hook_delay is the template alternative to MKMOCK_DELAY_ENABLED.
+template <typename Hook>
+void hook_delay() {
+  hook_delay<Hook>(hook_compiled_in<Hook>{});
+}
+#endif  // MKMOCK_ENABLE_TIME
+
+/// with_enabled_hook is the template alternative to
+/// MKMOCK_WITH_ENABLED_HOOK, calling @p func while the hook @p Hook is
+/// enabled with @p mocked, which is either a value or a sequence.
+template <typename Hook, typename Mocked, typename Func>
+void with_enabled_hook(Mocked &&mocked, Func &&func) {
+  with_enabled_hook<Hook>(std::forward<Mocked>(mocked), policy{},
+                          std::forward<Func>(func));
+}
+
+/// with_enabled_hook overload enabling the hook with @p policy.
+template <typename Hook, typename Mocked, typename Func>
+void with_enabled_hook(Mocked &&mocked, const policy &policy, Func &&func) {
+  static_assert(hook_compiled_in<Hook>::value, "mkmock: hook not compiled in");
+  std::unique_lock<recursive_mutex> _{Hook::singleton()->mutex};
+  enabled_scope<Hook> scope{std::forward<Mocked>(mocked), policy};
+  std::forward<Func>(func)();
+}
+
+/// with_thread_enabled_hook is the template alternative to
+/// MKMOCK_WITH_THREAD_ENABLED_HOOK.
+template <typename Hook, typename Func>
+void with_thread_enabled_hook(const typename Hook::value_type &mocked,
+                              Func &&func) {
+  static_assert(hook_compiled_in<Hook>::value, "mkmock: hook not compiled in");
+  thread_enabled_scope<Hook> scope{Hook::make_handle(mocked)};
+  std::forward<Func>(func)();
+}
+
+#ifdef MKMOCK_ENABLE_TIME
+/// virtual_time_hook is the hook that tells mkmock::clock to read the
+/// virtual_clock. Like other hooks, it is compiled in according to
+/// hook_compiled_in, hence it costs a single branch when disabled.
+class virtual_time_hook : public basic_hook<virtual_time_hook, bool> {
+ public:
+  static const char *name() noexcept { return "virtual_time"; }
+};
+
+/// basic_clock is a steady clock that code reads time from such that tests
+/// can replace it with the virtual_clock by enabling the hook @p Hook. While
+/// it is enabled, time points are virtual_clock::now() since the clock
+/// epoch, otherwise they are std::chrono::steady_clock time points. The two
+/// kinds of time points should not be compared with each other. It is a
+/// template, so that the state of @p Hook is only emitted by the programs
+/// reading the clock rather than by all those including this file.
+template <typename Hook>
+struct basic_clock {
+  using duration = std::chrono::steady_clock::duration;
+  using rep = duration::rep;
+  using period = duration::period;
+  using time_point = std::chrono::time_point<basic_clock, duration>;
+  static constexpr bool is_steady = true;
+
+  /// now returns the current time.
+  static time_point now() {
+    bool is_virtual = false;
+    hook<Hook>(is_virtual);
+    if (is_virtual) {
+      return time_point{
+          std::chrono::duration_cast<duration>(virtual_clock::now())};
+    }
+    return time_point{std::chrono::steady_clock::now().time_since_epoch()};
+  }
+
+  /// sleep_until blocks until now() reaches @p deadline.
+  static void sleep_until(time_point deadline) {
+    bool is_virtual = false;
+    hook<Hook>(is_virtual);
+    if (is_virtual) {
+      virtual_clock::sleep_until(deadline.time_since_epoch());
+      return;
+    }
+    std::this_thread::sleep_until(std::chrono::steady_clock::time_point{
+        deadline.time_since_epoch()});
+  }
+
+  /// sleep_for blocks for @p amount.
+  static void sleep_for(duration amount) {
+    sleep_until(time_point{saturating_add(now().time_since_epoch(), amount)});
+  }
+};
+
+/// clock is the basic_clock that MKMOCK_WITH_VIRTUAL_CLOCK makes read the
+/// virtual_clock.
+using clock = basic_clock<virtual_time_hook>;
+
+/// with_virtual_clock calls @p func while mkmock::clock reads the
+/// virtual_clock.
+template <typename Func>
+void with_virtual_clock(Func &&func) {
+  with_enabled_hook<virtual_time_hook>(true, std::forward<Func>(func));
+}
+#endif  // MKMOCK_ENABLE_TIME
+
+#ifdef MKMOCK_HAVE_VALUE_LOG
+/// recording_scope makes the sites of the hook @p Hook append the values
+/// they see to a value_log for its lifetime. The caller must hold the
+/// hook's mutex.
+template <typename Hook>
+class recording_scope {
+ public:
+  explicit recording_scope(std::shared_ptr<value_log> log) {
+    Hook::singleton()->record(std::move(log));
+    Hook::singleton()->arm();
+    Hook::singleton()->trace_scope(true);
+  }
+
+  ~recording_scope() {
+    Hook::singleton()->trace_scope(false);
+    Hook::singleton()->disarm();
+    Hook::singleton()->record(nullptr);
+  }
+
+  recording_scope(const recording_scope &) = delete;
+  recording_scope &operator=(const recording_scope &) = delete;
+};
+
+/// replaying_scope makes the sites of the hook @p Hook replay the values
+/// recorded into a value_log for its lifetime. The caller must hold the
+/// hook's mutex.
+template <typename Hook>
+class replaying_scope {
+ public:
+  explicit replaying_scope(std::shared_ptr<const value_log> log) {
+    Hook::singleton()->replay(std::move(log));
+    Hook::singleton()->arm();
+    Hook::singleton()->trace_scope(true);
+  }
+
+  ~replaying_scope() {
+    Hook::singleton()->trace_scope(false);
+    Hook::singleton()->disarm();
+    Hook::singleton()->replay(nullptr);
+  }
+
+  replaying_scope(const replaying_scope &) = delete;
+  replaying_scope &operator=(const replaying_scope &) = delete;
+};
+
+/// with_recording_hook is the template alternative to
+/// MKMOCK_WITH_RECORDING_HOOK.
+template <typename Hook, typename Func>
+void with_recording_hook(std::shared_ptr<value_log> log, Func &&func) {
+  static_assert(hook_compiled_in<Hook>::value, "mkmock: hook not compiled in");
+  std::unique_lock<recursive_mutex> _{Hook::singleton()->mutex};
+  recording_scope<Hook> scope{std::move(log)};
+  std::forward<Func>(func)();
+}
+
+/// with_replaying_hook is the template alternative to
+/// MKMOCK_WITH_REPLAYING_HOOK.
+template <typename Hook, typename Func>
+void with_replaying_hook(std::shared_ptr<const value_log> log, Func &&func) {
+  static_assert(hook_compiled_in<Hook>::value, "mkmock: hook not compiled in");
+  std::unique_lock<recursive_mutex> _{Hook::singleton()->mutex};
+  replaying_scope<Hook> scope{std::move(log)};
+  std::forward<Func>(func)();
+}
+#endif  // MKMOCK_HAVE_VALUE_LOG
+
+#if defined(MKMOCK_ENABLE_CONTROL) && defined(MKMOCK_HAVE_HOOK_REGISTRY) && \
+    defined(MKMOCK_HAVE_MMAP)
+/// control_slot is the part of the control segment describing a hook.
+struct control_slot {
+  char name[64];  ///< The hook's name, possibly truncated.
+
+  /// size is the size of the hook's value, or zero if the hook cannot be
+  /// controlled because its values are not trivially copyable or larger
+  /// than MKMOCK_CONTROL_VALUE_SIZE.
+  std::uint32_t size;
+
+  /// enabled is set by the controller to enable the hook.
+  std::atomic<std::uint32_t> enabled;
+
+  /// value is set by the controller to the bytes of the hook's value.
+  std::atomic<std::uint64_t> value[(MKMOCK_CONTROL_VALUE_SIZE + 7) / 8];
+
+  /// request is incremented by the controller after changing enabled or
+  /// value, and applied is set to it by the process once it has applied
+  /// the change.
+  std::atomic<std::uint64_t> request;
+  std::atomic<std::uint64_t> applied;
+
+  /// hits and overrides are the hook's counters, which are published by
+  /// the process when MKMOCK_ENABLE_COUNTERS is defined.
+  std::atomic<std::uint64_t> hits;
+  std::atomic<std::uint64_t> overrides;
+};
+
+/// control_header is the header of the control segment, which is followed
+/// by one control_slot per hook. All fields are in the host byte order.
+struct control_header {
+  char magic[8];         ///< Always "MKMOCKCP".
+  std::uint32_t version;  ///< Currently 1.
+  std::uint32_t slots;    ///< The number of slots.
+};
+
+/// control_path returns the name of the POSIX shared memory segment of
+/// the process with ID @p pid.
+inline std::string control_path(long pid) {
+  return "/mkmock." + std::to_string(pid);
+}
+
+/// control_plane exposes the hooks defined using MKMOCK_DEFINE_HOOK in a
+/// POSIX shared memory segment, which a controller, such as tools/control,
+/// may modify to enable hooks and to set their values without restarting
+/// the process. A thread polls the segment every MKMOCK_CONTROL_INTERVAL
+/// milliseconds and applies the changes, hence hook sites still only load
+/// the hook's atomic enabled field.
+class control_plane {
+ public:
+  /// start creates the segment named @p name, which defaults to
+  /// control_path(getpid()), and starts polling it. It returns false if
+  /// the control plane is already running or on failure.
+  static bool start(const char *name = nullptr) {
+    control_plane &plane = get();
+    std::unique_lock<std::mutex> lock{plane.mutex_};
+    if (plane.thread_.joinable()) {
+      return false;
+    }
+    plane.name_ = (name != nullptr) ? name : control_path(::getpid());
+    plane.hooks_ = registered_hooks();
+    plane.size_ = sizeof(control_header) +
+                  plane.hooks_.size() * sizeof(control_slot);
+    int fd = ::shm_open(plane.name_.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0600);
+    if (fd == -1) {
+      return false;
+    }
+    void *base = MAP_FAILED;
+    if (::ftruncate(fd, static_cast<off_t>(plane.size_)) == 0) {
+      base = ::mmap(nullptr, plane.size_, PROT_READ | PROT_WRITE, MAP_SHARED,
+                    fd, 0);
+    }
+    ::close(fd);
+    if (base == MAP_FAILED) {
+      ::shm_unlink(plane.name_.c_str());
+      return false;
+    }
+    plane.header_ = static_cast<control_header *>(base);
+    std::memcpy(plane.header_->magic, "MKMOCKCP", sizeof(plane.header_->magic));
+    plane.header_->version = 1;
+    plane.header_->slots = static_cast<std::uint32_t>(plane.hooks_.size());
+    for (size_t i = 0; i < plane.hooks_.size(); ++i) {
+      control_slot &slot = plane.slot(i);
+      std::snprintf(slot.name, sizeof(slot.name), "%s", plane.hooks_[i]->name);
+      slot.size = (plane.hooks_[i]->control != nullptr &&
+                   plane.hooks_[i]->size <= MKMOCK_CONTROL_VALUE_SIZE)
+                      ? static_cast<std::uint32_t>(plane.hooks_[i]->size)
+                      : 0;
+    }
+    plane.enabled_.assign(plane.hooks_.size(), false);
+    plane.stopping_ = false;
+    plane.thread_ = std::thread{[&plane]() { plane.run(); }};
+    return true;
+  }
+
+  /// stop stops polling, disables the hooks enabled through the segment
+  /// and removes the segment.
+  static void stop() {
+    control_plane &plane = get();
+    std::unique_lock<std::mutex> lock{plane.mutex_};
+    if (!plane.thread_.joinable()) {
+      return;
+    }
+    plane.stopping_ = true;
+    plane.cond_.notify_all();
+    lock.unlock();
+    plane.thread_.join();
+    lock.lock();
+    for (size_t i = 0; i < plane.hooks_.size(); ++i) {
+      if (plane.enabled_[i]) {
+        plane.hooks_[i]->control(nullptr, true);
+      }
+    }
+    ::munmap(plane.header_, plane.size_);
+    ::shm_unlink(plane.name_.c_str());
+    plane.header_ = nullptr;
+  }
+
+  ~control_plane() { stop(); }
+
+ private:
+  control_plane() = default;
+
+  static control_plane &get() {
+    static control_plane plane;
+    return plane;
+  }
+
+  control_slot &slot(size_t index) noexcept {
+    return reinterpret_cast<control_slot *>(header_ + 1)[index];
+  }
+
+  void run() {
+    std::unique_lock<std::mutex> lock{mutex_};
+    while (!stopping_) {
+      for (size_t i = 0; i < hooks_.size(); ++i) {
+        poll(i);
+      }
+      cond_.wait_for(lock, std::chrono::milliseconds(MKMOCK_CONTROL_INTERVAL));
+    }
+  }
+
+  void poll(size_t index) {
+    control_slot &current = slot(index);
+    const hook_descriptor &desc = *hooks_[index];
+#ifdef MKMOCK_ENABLE_COUNTERS
+    hook_counters counters = read_counters(desc.hook->id(desc.name));
+    current.hits.store(counters.hits, std::memory_order_relaxed);
+    current.overrides.store(counters.overrides, std::memory_order_relaxed);
+#endif
+    std::uint64_t request = current.request.load(std::memory_order_acquire);
+    if (request == current.applied.load(std::memory_order_relaxed) ||
+        current.size == 0) {
+      return;
+    }
+    bool enable = current.enabled.load(std::memory_order_relaxed) != 0;
+    std::uint64_t value[(MKMOCK_CONTROL_VALUE_SIZE + 7) / 8];
+    for (size_t i = 0; i < sizeof(value) / sizeof(value[0]); ++i) {
+      value[i] = current.value[i].load(std::memory_order_relaxed);
+    }
+    if (enable) {
+      desc.control(value, !enabled_[index]);
+    } else if (enabled_[index]) {
+      desc.control(nullptr, true);
+    }
+    enabled_[index] = enable;
+    current.applied.store(request, std::memory_order_release);
+  }
+
+  std::mutex mutex_;
+  std::condition_variable cond_;
+  std::thread thread_;
+  bool stopping_ = false;
+  std::string name_;
+  std::vector<const hook_descriptor *> hooks_;
+  std::vector<bool> enabled_;
+  control_header *header_ = nullptr;
+  size_t size_ = 0;
+};
+#endif  // MKMOCK_ENABLE_CONTROL
+
+}  // namespace mkmock
+
 #endif  // MEASUREMENT_KIT_MKMOCK_HPP
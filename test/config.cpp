@@ -0,0 +1,133 @@
+// Part of Measurement Kit <https://measurement-kit.github.io/>.
+// Measurement Kit is free software under the BSD license. See AUTHORS
+// and LICENSE for more information on the copying conditions.
+
+// Checks that parse_config accepts valid entries and rejects invalid ones,
+// and that the configuration read from MKMOCK_CONFIG sets the values and
+// the policies of hooks, unless scopes or the control plane override them.
+// Build and run with:
+//
+//     c++ -std=c++11 -O2 -I. test/config.cpp -o config -pthread
+//     MKMOCK_CONFIG=@test/config.txt ./config
+
+#define MKMOCK_ENABLE_CONFIG
+#include "mkmock.hpp"
+
+#include <map>
+#include <string>
+
+#include "test/expect.hpp"
+
+MKMOCK_DEFINE_HOOK(connect_rv, int);
+MKMOCK_DEFINE_HOOK(name, std::string);
+MKMOCK_DEFINE_HOOK(scheduled, long);
+MKMOCK_DEFINE_HOOK(probable, double);
+MKMOCK_DEFINE_HOOK(bad_value, int);
+MKMOCK_DEFINE_HOOK(bad_option, int);
+MKMOCK_DEFINE_HOOK(unconfigured, int);
+MKMOCK_DEFINE_HOOK(controlled, int);
+MKMOCK_DEFINE_HOOK(controlled_early, int);
+
+template <typename Hook, typename Type>
+static Type hit(Type value) {
+  mkmock::hook<Hook>(value);
+  return value;
+}
+
+static bool parses(const char *text) {
+  std::map<std::string, mkmock::config_entry> entries;
+  return mkmock::parse_config(text, entries);
+}
+
+static void check_parsing() {
+  std::map<std::string, mkmock::config_entry> entries;
+  MKMOCK_EXPECT(mkmock::parse_config(
+      "a=1; b = two words , skip=3\n# comment\n\n"
+      "c=4,probability=0.25,times=2,every=5",
+      entries));
+  MKMOCK_EXPECT(entries.size() == 3);
+  MKMOCK_EXPECT(entries["a"].value == "1");
+  MKMOCK_EXPECT(entries["b"].value == "two words");
+  MKMOCK_EXPECT(entries["b"].policy.skip == 3);
+  MKMOCK_EXPECT(entries["c"].policy.probability == 0.25);
+  MKMOCK_EXPECT(entries["c"].policy.times == 2);
+  MKMOCK_EXPECT(entries["c"].policy.every == 5);
+
+  MKMOCK_EXPECT(!parses("missing_value"));
+  MKMOCK_EXPECT(!parses("=1"));
+  MKMOCK_EXPECT(!parses("a=1,bogus=2"));
+  MKMOCK_EXPECT(!parses("a=1,skip=-1"));
+  MKMOCK_EXPECT(!parses("a=1,times=x"));
+  MKMOCK_EXPECT(!parses("a=1,probability="));
+
+  // Invalid entries are skipped, while the valid ones are kept.
+  entries.clear();
+  MKMOCK_EXPECT(!mkmock::parse_config("a=1,every=;b=2", entries));
+  MKMOCK_EXPECT(entries.size() == 1 && entries["b"].value == "2");
+}
+
+static void check_application() {
+  MKMOCK_EXPECT(hit<mkmock_connect_rv>(0) == -1);
+  MKMOCK_EXPECT(hit<mkmock_connect_rv>(0) == -1);
+  MKMOCK_EXPECT(hit<mkmock_name>(std::string{"real"}) == "hello world");
+
+  long scheduled[6];
+  for (long &value : scheduled) {
+    value = hit<mkmock_scheduled>(0L);
+  }
+  MKMOCK_EXPECT(scheduled[0] == 0 && scheduled[1] == 0 && scheduled[2] == 7 &&
+                scheduled[3] == 0 && scheduled[4] == 7 && scheduled[5] == 0);
+
+  mkmock::seed_random(1);
+  int overrides = 0;
+  for (int i = 0; i < 10000; ++i) {
+    overrides += hit<mkmock_probable>(0.0) == 2.5;
+  }
+  MKMOCK_EXPECT(overrides > 4000 && overrides < 6000);
+
+  MKMOCK_EXPECT(hit<mkmock_bad_value>(1) == 1);
+  MKMOCK_EXPECT(hit<mkmock_bad_option>(1) == 1);
+  MKMOCK_EXPECT(hit<mkmock_unconfigured>(1) == 1);
+
+  // Scopes override the configuration, which applies again afterwards.
+  MKMOCK_WITH_ENABLED_HOOK(connect_rv, 5, {
+    MKMOCK_EXPECT(hit<mkmock_connect_rv>(0) == 5);
+  });
+  MKMOCK_EXPECT(hit<mkmock_connect_rv>(0) == -1);
+}
+
+// check_control drives hooks like the control plane does, through their
+// descriptors, overriding the configuration until it disables them.
+static void check_control() {
+#ifdef MKMOCK_HAVE_HOOK_REGISTRY
+  const mkmock::hook_descriptor *desc = mkmock::find_hook("controlled");
+  MKMOCK_EXPECT(desc != nullptr && desc->control != nullptr);
+  MKMOCK_EXPECT(hit<mkmock_controlled>(0) == 0);
+  MKMOCK_EXPECT(hit<mkmock_controlled>(0) == 7);
+  int value = 3;
+  desc->control(&value, true);
+  MKMOCK_EXPECT(hit<mkmock_controlled>(0) == 3);
+  MKMOCK_EXPECT(hit<mkmock_controlled>(0) == 3);
+  desc->control(nullptr, true);
+  MKMOCK_EXPECT(hit<mkmock_controlled>(0) == 0);
+  MKMOCK_EXPECT(hit<mkmock_controlled>(0) == 7);
+
+  // The configuration of a hook enabled before its first hit does not
+  // override the control plane at such hit.
+  desc = mkmock::find_hook("controlled_early");
+  MKMOCK_EXPECT(desc != nullptr && desc->control != nullptr);
+  value = 4;
+  desc->control(&value, true);
+  MKMOCK_EXPECT(hit<mkmock_controlled_early>(0) == 4);
+  MKMOCK_EXPECT(hit<mkmock_controlled_early>(0) == 4);
+  desc->control(nullptr, true);
+  MKMOCK_EXPECT(hit<mkmock_controlled_early>(0) == 0);
+  MKMOCK_EXPECT(hit<mkmock_controlled_early>(0) == 9);
+#endif
+}
+
+int main() {
+  check_parsing();
+  check_application();
+  check_control();
+}
@@ -0,0 +1,21 @@
+// Part of Measurement Kit <https://measurement-kit.github.io/>.
+// Measurement Kit is free software under the BSD license. See AUTHORS
+// and LICENSE for more information on the copying conditions.
+#ifndef MEASUREMENT_KIT_MKMOCK_TEST_EXPECT_HPP
+#define MEASUREMENT_KIT_MKMOCK_TEST_EXPECT_HPP
+
+#include <cstdio>
+#include <cstdlib>
+
+/// MKMOCK_EXPECT exits with failure, telling where, unless @p Condition
+/// holds. Unlike assert, it is not compiled out in release builds.
+#define MKMOCK_EXPECT(Condition)                                       \
+  do {                                                                 \
+    if (!(Condition)) {                                                \
+      std::fprintf(stderr, "%s:%d: expected %s\n", __FILE__, __LINE__, \
+                   #Condition);                                        \
+      std::exit(EXIT_FAILURE);                                         \
+    }                                                                  \
+  } while (0)
+
+#endif  // MEASUREMENT_KIT_MKMOCK_TEST_EXPECT_HPP
@@ -0,0 +1,105 @@
+// Part of Measurement Kit <https://measurement-kit.github.io/>.
+// Measurement Kit is free software under the BSD license. See AUTHORS
+// and LICENSE for more information on the copying conditions.
+
+// Checks that enabled hooks override variables according to schedules and
+// probabilities, also when many threads reach them, and that probabilities
+// are reproducible given the seed. Build with:
+//
+//     c++ -std=c++11 -O2 -I. test/policy.cpp -o policy -pthread
+
+#include "mkmock.hpp"
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include "test/expect.hpp"
+
+MKMOCK_DEFINE_HOOK(policy_rv, int);
+
+static int hit() {
+  int rv = 0;
+  MKMOCK_HOOK_ENABLED(policy_rv, rv);
+  return rv;
+}
+
+static int count_overrides(int hits) {
+  int count = 0;
+  for (int i = 0; i < hits; ++i) {
+    count += hit();
+  }
+  return count;
+}
+
+static void check_schedules() {
+  MKMOCK_WITH_POLICY_ENABLED_HOOK(policy_rv, 1, mkmock::with_schedule(2, 1), {
+    MKMOCK_EXPECT(hit() == 0 && hit() == 0 && hit() == 1);
+    MKMOCK_EXPECT(hit() == 0 && hit() == 0);
+  });
+  MKMOCK_WITH_POLICY_ENABLED_HOOK(
+      policy_rv, 1, mkmock::with_schedule(99, 1, 100), {
+        for (int i = 1; i <= 1000; ++i) {
+          MKMOCK_EXPECT(hit() == (i % 100 == 0));
+        }
+      });
+  // Hits are numbered across threads, hence the total does not depend on
+  // how threads interleave.
+  std::atomic<int> total{0};
+  MKMOCK_WITH_POLICY_ENABLED_HOOK(
+      policy_rv, 1, mkmock::with_schedule(10, 5, 1000), {
+        std::vector<std::thread> threads;
+        for (int i = 0; i < 8; ++i) {
+          threads.emplace_back([&total]() { total += count_overrides(12500); });
+        }
+        for (auto &thread : threads) {
+          thread.join();
+        }
+      });
+  MKMOCK_EXPECT(total == 5 + 99);
+  // Scopes without a policy always override.
+  MKMOCK_WITH_ENABLED_HOOK(policy_rv, 1, {
+    MKMOCK_EXPECT(count_overrides(1000) == 1000);
+  });
+}
+
+static void check_probabilities() {
+  int first = 0, second = 0, never = 0, always = 0;
+  mkmock::seed_random(42);
+  MKMOCK_WITH_POLICY_ENABLED_HOOK(policy_rv, 1, mkmock::with_probability(0.01), {
+    first = count_overrides(100000);
+  });
+  mkmock::seed_random(42);
+  MKMOCK_WITH_POLICY_ENABLED_HOOK(policy_rv, 1, mkmock::with_probability(0.01), {
+    second = count_overrides(100000);
+  });
+  MKMOCK_WITH_POLICY_ENABLED_HOOK(policy_rv, 1, mkmock::with_probability(0), {
+    never = count_overrides(100000);
+  });
+  MKMOCK_WITH_POLICY_ENABLED_HOOK(policy_rv, 1, mkmock::with_probability(1), {
+    always = count_overrides(100000);
+  });
+  MKMOCK_EXPECT(first == second);
+  MKMOCK_EXPECT(first > 800 && first < 1200);
+  MKMOCK_EXPECT(never == 0 && always == 100000);
+  // Probabilities apply to the hits allowed by the schedule.
+  MKMOCK_WITH_POLICY_ENABLED_HOOK(
+      policy_rv, 1,
+      ([]() {
+        mkmock::policy policy = mkmock::with_schedule(1000, 1000);
+        policy.probability = 0.5;
+        return policy;
+      }()),
+      {
+        MKMOCK_EXPECT(count_overrides(1000) == 0);
+        int count = count_overrides(1000);
+        MKMOCK_EXPECT(count > 400 && count < 600);
+        MKMOCK_EXPECT(count_overrides(1000) == 0);
+      });
+}
+
+int main() {
+  check_schedules();
+  check_probabilities();
+  MKMOCK_EXPECT(hit() == 0);
+}
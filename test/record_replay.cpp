@@ -0,0 +1,95 @@
+// Part of Measurement Kit <https://measurement-kit.github.io/>.
+// Measurement Kit is free software under the BSD license. See AUTHORS
+// and LICENSE for more information on the copying conditions.
+
+// Checks that the values recorded by hook sites into a value_log are
+// replayed in order, per hook, and that sites see their real values again
+// once the recorded ones are exhausted. It writes record_replay.log into
+// the current directory. Build with:
+//
+//     c++ -std=c++11 -O2 -I. test/record_replay.cpp -o record_replay -pthread
+
+#define MKMOCK_ENABLE_RECORD
+#include "mkmock.hpp"
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include "test/expect.hpp"
+
+MKMOCK_DEFINE_HOOK(counter, int);
+MKMOCK_DEFINE_HOOK(ratio, double);
+
+static std::atomic<int> real_counter{0};
+
+static int next_counter() {
+  int value = ++real_counter;
+  MKMOCK_HOOK_ENABLED(counter, value);
+  return value;
+}
+
+static double ratio(double value) {
+  MKMOCK_HOOK_ENABLED(ratio, value);
+  return value;
+}
+
+static const char *const path = "record_replay.log";
+
+static void record() {
+  auto log = mkmock::value_log::create(path, 1 << 20);
+  MKMOCK_EXPECT(log != nullptr);
+  MKMOCK_WITH_RECORDING_HOOK(counter, log, {
+    for (int i = 0; i < 5; ++i) {
+      next_counter();
+    }
+    std::vector<std::thread> threads;
+    for (int i = 0; i < 4; ++i) {
+      threads.emplace_back([]() {
+        for (int j = 0; j < 100; ++j) {
+          next_counter();
+        }
+      });
+    }
+    for (auto &thread : threads) {
+      thread.join();
+    }
+  });
+  MKMOCK_WITH_RECORDING_HOOK(ratio, log, {
+    MKMOCK_EXPECT(ratio(0.5) == 0.5);  // Recording does not override
+    ratio(0.25);
+  });
+  next_counter();  // Not recorded
+}
+
+static void replay() {
+  auto log = mkmock::value_log::open(path);
+  MKMOCK_EXPECT(log != nullptr);
+  MKMOCK_EXPECT(log->entries(mkmock::value_log::key("counter"))->size() == 405);
+  real_counter = 1000;
+  MKMOCK_WITH_REPLAYING_HOOK(counter, log, {
+    for (int i = 1; i <= 5; ++i) {
+      MKMOCK_EXPECT(next_counter() == i);
+    }
+    // The threads recorded 6 to 405 in some order.
+    int sum = 0;
+    for (int i = 0; i < 400; ++i) {
+      sum += next_counter();
+    }
+    MKMOCK_EXPECT(sum == (6 + 405) * 400 / 2);
+    MKMOCK_EXPECT(next_counter() == 1406);
+  });
+  MKMOCK_WITH_REPLAYING_HOOK(ratio, log, {
+    MKMOCK_EXPECT(ratio(1.0) == 0.5);
+    MKMOCK_EXPECT(ratio(1.0) == 0.25);
+    MKMOCK_EXPECT(ratio(1.0) == 1.0);
+  });
+  MKMOCK_EXPECT(next_counter() == 1407);
+}
+
+int main() {
+  record();
+  replay();
+  MKMOCK_EXPECT(mkmock::value_log::open("nonexistent/record_replay.log") ==
+                nullptr);
+}
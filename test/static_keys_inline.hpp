@@ -0,0 +1,36 @@
+// Part of Measurement Kit <https://measurement-kit.github.io/>.
+// Measurement Kit is free software under the BSD license. See AUTHORS
+// and LICENSE for more information on the copying conditions.
+#ifndef MEASUREMENT_KIT_MKMOCK_TEST_STATIC_KEYS_INLINE_HPP
+#define MEASUREMENT_KIT_MKMOCK_TEST_STATIC_KEYS_INLINE_HPP
+
+#include "mkmock.hpp"
+
+MKMOCK_DEFINE_HOOK(inline_site, int);
+
+// Both translation units of the test emit these functions, hence their
+// jump sites, into COMDAT groups, of which the linker keeps only one. They
+// must not be inlined, otherwise there would be no such group to discard.
+#if defined(__GNUC__)
+#define MKMOCK_TEST_NOINLINE __attribute__((noinline))
+#else
+#define MKMOCK_TEST_NOINLINE
+#endif
+
+MKMOCK_TEST_NOINLINE inline int inline_site() {
+  int rv = 1;
+  MKMOCK_HOOK_ENABLED(inline_site, rv);
+  return rv;
+}
+
+template <typename Hook>
+MKMOCK_TEST_NOINLINE int template_site() {
+  int rv = 1;
+  mkmock::hook<Hook>(rv);
+  return rv;
+}
+
+int other_inline_site();
+int other_template_site();
+
+#endif  // MEASUREMENT_KIT_MKMOCK_TEST_STATIC_KEYS_INLINE_HPP
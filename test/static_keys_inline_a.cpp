@@ -0,0 +1,26 @@
+// Part of Measurement Kit <https://measurement-kit.github.io/>.
+// Measurement Kit is free software under the BSD license. See AUTHORS
+// and LICENSE for more information on the copying conditions.
+
+// Checks that hook sites in inline functions and templates used by more
+// than one translation unit link and work with MKMOCK_USE_STATIC_KEYS.
+// Build with:
+//
+//     c++ -std=c++11 -O2 -DMKMOCK_USE_STATIC_KEYS -I. test/static_keys_inline_a.cpp test/static_keys_inline_b.cpp -o static_keys_inline -pthread
+
+#include "test/static_keys_inline.hpp"
+
+#include "test/expect.hpp"
+
+int main() {
+  MKMOCK_EXPECT(inline_site() == 1 && other_inline_site() == 1);
+  MKMOCK_EXPECT(template_site<mkmock_inline_site>() == 1);
+  MKMOCK_EXPECT(other_template_site() == 1);
+  MKMOCK_WITH_ENABLED_HOOK(inline_site, 5, {
+    MKMOCK_EXPECT(inline_site() == 5 && other_inline_site() == 5);
+    MKMOCK_EXPECT(template_site<mkmock_inline_site>() == 5);
+    MKMOCK_EXPECT(other_template_site() == 5);
+  });
+  MKMOCK_EXPECT(inline_site() == 1 && other_inline_site() == 1);
+  MKMOCK_EXPECT(template_site<mkmock_inline_site>() == 1);
+}
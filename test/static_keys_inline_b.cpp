@@ -0,0 +1,9 @@
+// Part of Measurement Kit <https://measurement-kit.github.io/>.
+// Measurement Kit is free software under the BSD license. See AUTHORS
+// and LICENSE for more information on the copying conditions.
+
+#include "test/static_keys_inline.hpp"
+
+int other_inline_site() { return inline_site(); }
+
+int other_template_site() { return template_site<mkmock_inline_site>(); }
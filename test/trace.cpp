@@ -0,0 +1,95 @@
+// Part of Measurement Kit <https://measurement-kit.github.io/>.
+// Measurement Kit is free software under the BSD license. See AUTHORS
+// and LICENSE for more information on the copying conditions.
+
+// Checks that a trace written by dump_trace converts with chrome_trace to
+// the events that happened, in order, and that chrome_trace rejects files
+// that are not traces. It writes trace.bin and trace.json into the current
+// directory. Build with:
+//
+//     c++ -std=c++11 -O2 -I. test/trace.cpp -o trace -pthread
+
+#define MKMOCK_ENABLE_TRACE
+#include "mkmock.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "test/expect.hpp"
+
+MKMOCK_DEFINE_HOOK(alpha, int);
+MKMOCK_DEFINE_HOOK(beta, int);
+
+static int hit(int value) {
+  MKMOCK_HOOK_ENABLED(alpha, value);
+  MKMOCK_HOOK_ENABLED(beta, value);
+  return value;
+}
+
+static bool convert(const char *from, const char *to) {
+  std::FILE *input = std::fopen(from, "rb");
+  std::FILE *output = std::fopen(to, "w");
+  MKMOCK_EXPECT(input != nullptr && output != nullptr);
+  bool ok = mkmock::chrome_trace(input, output);
+  std::fclose(input);
+  std::fclose(output);
+  return ok;
+}
+
+// events returns the name, category and phase of each event of the JSON
+// trace at @p path, which chrome_trace writes one per line, checking that
+// timestamps do not decrease.
+static std::vector<std::string> events(const char *path) {
+  std::vector<std::string> result;
+  std::FILE *filep = std::fopen(path, "r");
+  MKMOCK_EXPECT(filep != nullptr);
+  char line[512];
+  double last = 0.0;
+  while (std::fgets(line, sizeof(line), filep) != nullptr) {
+    char name[64], cat[64], ph[8];
+    double ts = 0.0;
+    if (std::sscanf(line, "{\"name\":\"%63[^\"]\",\"cat\":\"%63[^\"]\","
+                          "\"ph\":\"%7[^\"]\"",
+                    name, cat, ph) != 3) {
+      continue;
+    }
+    const char *where = std::strstr(line, "\"ts\":");
+    MKMOCK_EXPECT(where != nullptr && std::sscanf(where, "\"ts\":%lf", &ts) == 1);
+    MKMOCK_EXPECT(ts >= last);
+    last = ts;
+    result.push_back(std::string{name} + " " + cat + " " + ph);
+  }
+  std::fclose(filep);
+  return result;
+}
+
+int main() {
+  mkmock::start_trace();
+  hit(1);
+  MKMOCK_WITH_ENABLED_HOOK(alpha, 7, { MKMOCK_EXPECT(hit(1) == 7); });
+  MKMOCK_WITH_POLICY_ENABLED_HOOK(beta, 7, mkmock::with_schedule(1, 1), {
+    MKMOCK_EXPECT(hit(1) == 1);
+    MKMOCK_EXPECT(hit(1) == 7);
+  });
+  mkmock::stop_trace();
+  hit(1);  // Not traced
+
+  MKMOCK_EXPECT(mkmock::dump_trace("trace.bin"));
+  MKMOCK_EXPECT(convert("trace.bin", "trace.json"));
+  std::vector<std::string> expected = {
+      "alpha hit i",   "beta hit i",                       // Before scopes
+      "alpha scope B", "alpha override i", "beta hit i",   // alpha's scope
+      "alpha scope E",
+      "beta scope B",  "alpha hit i",      "beta hit i",   // beta's scope
+      "alpha hit i",   "beta override i",  "beta scope E"};
+  MKMOCK_EXPECT(events("trace.json") == expected);
+
+  std::FILE *filep = std::fopen("trace.bin", "wb");
+  MKMOCK_EXPECT(filep != nullptr);
+  MKMOCK_EXPECT(std::fputs("MKMOCKXX and some garbage", filep) >= 0);
+  std::fclose(filep);
+  MKMOCK_EXPECT(!convert("trace.bin", "trace.json"));
+}
@@ -0,0 +1,154 @@
+// Part of Measurement Kit <https://measurement-kit.github.io/>.
+// Measurement Kit is free software under the BSD license. See AUTHORS
+// and LICENSE for more information on the copying conditions.
+
+// Attaches to the control plane of a process that called
+// mkmock::control_plane::start to list its hooks and their counters and to
+// enable or disable them. The target is either a process ID or the name of
+// the shared memory segment. Integer and floating point values are encoded
+// according to the size of the hook's value, while `raw:` followed by hex
+// digits sets the bytes of the value. Build with:
+//
+//     c++ -std=c++11 -O2 -I. tools/control.cpp -o control -pthread -lrt
+
+#define MKMOCK_ENABLE_CONTROL
+#include "mkmock.hpp"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+
+static void usage(const char *progname) {
+  std::fprintf(stderr,
+               "usage: %s target list\n"
+               "       %s target enable hook [value]\n"
+               "       %s target disable hook\n",
+               progname, progname, progname);
+  std::exit(2);
+}
+
+static bool encode(const char *text, std::uint32_t size, unsigned char *out) {
+  std::memset(out, 0, MKMOCK_CONTROL_VALUE_SIZE);
+  char *end = nullptr;
+  if (std::strncmp(text, "raw:", 4) == 0) {
+    std::string hex = text + 4;
+    if (hex.size() != 2 * size) {
+      return false;
+    }
+    for (std::uint32_t i = 0; i < size; ++i) {
+      std::string byte = hex.substr(2 * i, 2);
+      out[i] = static_cast<unsigned char>(std::strtoul(byte.c_str(), &end, 16));
+      if (*end != '\0') {
+        return false;
+      }
+    }
+    return true;
+  }
+  bool is_float = std::strpbrk(text, ".eEnN") != nullptr &&
+                  std::strncmp(text, "0x", 2) != 0;
+  if (is_float && size == sizeof(float)) {
+    float value = std::strtof(text, &end);
+    std::memcpy(out, &value, sizeof(value));
+  } else if (is_float && size == sizeof(double)) {
+    double value = std::strtod(text, &end);
+    std::memcpy(out, &value, sizeof(value));
+  } else {
+    long long value = std::strtoll(text, &end, 0);
+    std::int8_t v8 = static_cast<std::int8_t>(value);
+    std::int16_t v16 = static_cast<std::int16_t>(value);
+    std::int32_t v32 = static_cast<std::int32_t>(value);
+    std::int64_t v64 = static_cast<std::int64_t>(value);
+    switch (size) {
+      case 1: std::memcpy(out, &v8, size); break;
+      case 2: std::memcpy(out, &v16, size); break;
+      case 4: std::memcpy(out, &v32, size); break;
+      case 8: std::memcpy(out, &v64, size); break;
+      default: return false;
+    }
+  }
+  return *text != '\0' && *end == '\0';
+}
+
+int main(int argc, char **argv) {
+  if (argc < 3) {
+    usage(argv[0]);
+  }
+  std::string name = argv[1];
+  if (name.find_first_not_of("0123456789") == std::string::npos) {
+    name = mkmock::control_path(std::atol(argv[1]));
+  }
+  int fd = ::shm_open(name.c_str(), O_RDWR, 0);
+  struct stat info;
+  if (fd == -1 || ::fstat(fd, &info) != 0) {
+    std::perror(name.c_str());
+    return 1;
+  }
+  void *base = ::mmap(nullptr, static_cast<size_t>(info.st_size),
+                      PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  ::close(fd);
+  auto header = static_cast<mkmock::control_header *>(base);
+  if (base == MAP_FAILED ||
+      static_cast<size_t>(info.st_size) < sizeof(*header) ||
+      std::memcmp(header->magic, "MKMOCKCP", sizeof(header->magic)) != 0 ||
+      header->version != 1 ||
+      static_cast<size_t>(info.st_size) <
+          sizeof(*header) + header->slots * sizeof(mkmock::control_slot)) {
+    std::fprintf(stderr, "%s: not a control segment\n", name.c_str());
+    return 1;
+  }
+  auto slots = reinterpret_cast<mkmock::control_slot *>(header + 1);
+  std::string command = argv[2];
+  if (command == "list" && argc == 3) {
+    std::printf("%-32s %6s %7s %12s %12s\n", "hook", "size", "enabled", "hits",
+                "overrides");
+    for (std::uint32_t i = 0; i < header->slots; ++i) {
+      std::printf("%-32s %6u %7u %12llu %12llu\n", slots[i].name, slots[i].size,
+                  slots[i].enabled.load(),
+                  static_cast<unsigned long long>(slots[i].hits.load()),
+                  static_cast<unsigned long long>(slots[i].overrides.load()));
+    }
+    return 0;
+  }
+  if ((command != "enable" || (argc != 4 && argc != 5)) &&
+      (command != "disable" || argc != 4)) {
+    usage(argv[0]);
+  }
+  mkmock::control_slot *slot = nullptr;
+  for (std::uint32_t i = 0; i < header->slots; ++i) {
+    if (std::strcmp(slots[i].name, argv[3]) == 0) {
+      slot = &slots[i];
+    }
+  }
+  if (slot == nullptr || slot->size == 0) {
+    std::fprintf(stderr, "%s: no such hook or hook cannot be controlled\n",
+                 argv[3]);
+    return 1;
+  }
+  if (argc == 5) {
+    unsigned char value[MKMOCK_CONTROL_VALUE_SIZE];
+    if (!encode(argv[4], slot->size, value)) {
+      std::fprintf(stderr, "%s: invalid value for a %u bytes hook\n", argv[4],
+                   slot->size);
+      return 1;
+    }
+    for (size_t i = 0; i < sizeof(slot->value) / sizeof(slot->value[0]); ++i) {
+      std::uint64_t word = 0;
+      std::memcpy(&word, value + 8 * i, sizeof(word));
+      slot->value[i].store(word, std::memory_order_relaxed);
+    }
+  }
+  slot->enabled.store(command == "enable", std::memory_order_relaxed);
+  std::uint64_t request = slot->request.fetch_add(1, std::memory_order_release) + 1;
+  for (int i = 0; i < 100; ++i) {
+    if (slot->applied.load(std::memory_order_acquire) >= request) {
+      return 0;
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+  std::fprintf(stderr, "%s: the process did not apply the change\n",
+               name.c_str());
+  return 1;
+}
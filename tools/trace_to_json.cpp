@@ -0,0 +1,43 @@
+// Part of Measurement Kit <https://measurement-kit.github.io/>.
+// Measurement Kit is free software under the BSD license. See AUTHORS
+// and LICENSE for more information on the copying conditions.
+
+// Converts a binary trace written by mkmock::dump_trace into the Chrome
+// trace event JSON format, which chrome://tracing and Perfetto display.
+// The output is written to standard output unless a path is given. Build
+// with:
+//
+//     c++ -std=c++11 -O2 -I. tools/trace_to_json.cpp -o trace_to_json -pthread
+
+#define MKMOCK_ENABLE_TRACE
+#include "mkmock.hpp"
+
+#include <cstdio>
+
+int main(int argc, char **argv) {
+  if (argc != 2 && argc != 3) {
+    std::fprintf(stderr, "usage: %s trace-file [json-file]\n", argv[0]);
+    return 2;
+  }
+  std::FILE *input = std::fopen(argv[1], "rb");
+  if (input == nullptr) {
+    std::perror(argv[1]);
+    return 1;
+  }
+  std::FILE *output = stdout;
+  if (argc == 3 && (output = std::fopen(argv[2], "w")) == nullptr) {
+    std::perror(argv[2]);
+    std::fclose(input);
+    return 1;
+  }
+  bool ok = mkmock::chrome_trace(input, output);
+  std::fclose(input);
+  if (output != stdout) {
+    ok = (std::fclose(output) == 0) && ok;
+  }
+  if (!ok) {
+    std::fprintf(stderr, "%s: cannot convert the trace\n", argv[1]);
+    return 1;
+  }
+  return 0;
+}